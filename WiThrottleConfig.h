@@ -0,0 +1,116 @@
+/* -*- c++ -*-
+ *
+ * WiThrottleConfig
+ *
+ * Feature policies for the WiThrottleProtocol library.  A protocol object
+ * is a BasicWiThrottleProtocol<Features>, and the Features class says
+ * which parts of the library it is built with and how big its buffers
+ * are.  A part that is turned off takes no code and no per-connection
+ * state.
+ *
+ * WiThrottleProtocol is BasicWiThrottleProtocol<WiThrottleFeatures>, with
+ * everything turned on.  For anything else, start from one of the
+ * policies here and change what needs changing:
+ *
+ *     struct ClockFeatures : WiThrottleFastClockFeatures {
+ *         static constexpr bool logging = true;
+ *     };
+ *     BasicWiThrottleProtocol<ClockFeatures> clock;
+ *
+ * The policy is part of the sketch, so nothing needs to be set when the
+ * library is built, and objects with different policies can be used side
+ * by side in one program (a fast clock and a panel on the same board,
+ * for example).
+ *
+ * Copyright © 2018-2019, 2021 Blue Knobby Systems Inc.
+ *
+ * This work is licensed under the Creative Commons Attribution-ShareAlike
+ * 4.0 International License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-sa/4.0/ or send a letter to
+ * Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+ *
+ * Attribution — You must give appropriate credit, provide a link to the
+ * license, and indicate if changes were made. You may do so in any
+ * reasonable manner, but not in any way that suggests the licensor
+ * endorses you or your use.
+ *
+ * ShareAlike — If you remix, transform, or build upon the material, you
+ * must distribute your contributions under the same license as the
+ * original.
+ *
+ * All other rights reserved.
+ *
+ */
+
+#ifndef WITHROTTLE_CONFIG_H
+#define WITHROTTLE_CONFIG_H
+
+// Everything, which is what WiThrottleProtocol is built with.
+struct WiThrottleFeatures
+{
+    // PFT fast time tracking (fastTimeHours() and friends)
+    static constexpr bool fastClock = true;
+
+    // locomotive selection, speed, direction, functions and momentum
+    static constexpr bool throttle = true;
+
+    // turnout and route control
+    static constexpr bool turnouts = true;
+
+    // acting as the server end of a connection (the constructor's server
+    // argument)
+    static constexpr bool server = true;
+
+    // alert, info and identity messages from the server (HM, Hm, HT, Ht)
+    static constexpr bool messages = true;
+
+    // debug messages written to the console given to begin()
+    static constexpr bool logging = true;
+
+    // the longest line that can be received from the server, plus one
+    static constexpr int inputBufferSize = 1024;
+
+    // the most that beginBatch() collects before it has to write; 0
+    // leaves batching out
+    static constexpr int batchSize = 256;
+
+    // how many locomotives can be on the throttle at once (a consist)
+    static constexpr int maxConsist = 4;
+
+    // how many server messages are kept, and the longest that can be
+    // kept (plus one); longer messages are cut short
+    static constexpr int messageSlots = 4;
+    static constexpr int messageSize = 80;
+
+    // how many turnout and route commands can wait for confirmation at once
+    static constexpr int maxPendingCommands = 16;
+
+    // the longest turnout or route system name that can be tracked, plus one
+    static constexpr int systemNameSize = 24;
+};
+
+
+// A fast clock display: PFT and nothing else.
+struct WiThrottleFastClockFeatures : WiThrottleFeatures
+{
+    static constexpr bool throttle = false;
+    static constexpr bool turnouts = false;
+    static constexpr bool server = false;
+    static constexpr bool messages = false;
+    static constexpr bool logging = false;
+    static constexpr int inputBufferSize = 128;
+    static constexpr int batchSize = 0;
+};
+
+
+// An accessory or CTC panel: turnouts and routes, no locomotives.
+struct WiThrottlePanelFeatures : WiThrottleFeatures
+{
+    static constexpr bool fastClock = false;
+    static constexpr bool throttle = false;
+    static constexpr bool server = false;
+    static constexpr bool logging = false;
+    static constexpr int inputBufferSize = 256;
+};
+
+#endif // WITHROTTLE_CONFIG_H
@@ -30,7 +30,8 @@
 #define WITHROTTLE_H
 
 #include "Arduino.h"
-#include "Chrono.h"
+
+#include "WiThrottleConfig.h"
 
 typedef enum Direction {
     Reverse = 0,
@@ -43,6 +44,61 @@ typedef enum TrackPower {
     PowerUnknown = 2
 } TrackPower;
 
+typedef enum TurnoutAction {
+    TurnoutClose = 'C',
+    TurnoutThrow = 'T',
+    TurnoutToggle = '2'
+} TurnoutAction;
+
+typedef enum TurnoutState {
+    TurnoutUnknown = 1,
+    TurnoutClosed = 2,
+    TurnoutThrown = 4,
+    TurnoutInconsistent = 8
+} TurnoutState;
+
+typedef enum RouteState {
+    RouteUnknown = 1,
+    RouteActive = 2,
+    RouteInactive = 4,
+    RouteInconsistent = 8
+} RouteState;
+
+typedef enum ServerMessageType {
+    MessageAlert = 'M',        // HM
+    MessageInfo = 'm',         // Hm
+    MessageServerType = 'T',   // HT
+    MessageServerDescription = 't'  // Ht
+} ServerMessageType;
+
+// The messages a server sends when a connection is made.  The
+// session is ready once all of the requested ones have been seen.
+typedef enum Greeting {
+    GreetingVersion = 0x01,     // VN
+    GreetingRoster = 0x02,      // RL
+    GreetingTrackPower = 0x04,  // PPA
+    GreetingWebPort = 0x08,     // PW
+    GreetingHeartbeat = 0x10,   // *nn
+    GreetingLocomotive = 0x20   // MT+ for the requested locomotive
+} Greeting;
+
+static const uint8_t DEFAULT_READY_WHEN = GreetingVersion | GreetingRoster | GreetingTrackPower;
+
+
+struct WiThrottleConnectOptions
+{
+    WiThrottleConnectOptions():
+        requireHeartbeat(false),
+        readyWhen(DEFAULT_READY_WHEN)
+    { }
+
+    String deviceName;      // sent as N, if not empty
+    String deviceID;        // sent as H, if not empty
+    bool requireHeartbeat;  // send *+
+    String locomotive;      // [S|L]nnnn to select, if not empty
+    uint8_t readyWhen;      // Greeting values that make the session ready
+};
+
 
 
 class WiThrottleProtocolDelegate
@@ -50,6 +106,8 @@ class WiThrottleProtocolDelegate
   public:
     virtual void receivedVersion(String version) {}
 
+    virtual void sessionReady() { }
+
     virtual void fastTimeChanged(uint32_t time) { }
     virtual void fastTimeRateChanged(double rate) { }
 
@@ -64,27 +122,317 @@ class WiThrottleProtocolDelegate
     virtual void receivedWebPort(int port) { }            // PWnnnnn
     virtual void receivedTrackPower(TrackPower state) { } // PPAn
 
+    // text is only good until this method returns.  Return true once
+    // the message has been dealt with, or false to have it kept for
+    // nextServerMessage().
+    virtual bool receivedServerMessage(ServerMessageType type, const char *text) { return false; } // H[MmTt]text
+
     virtual void addressAdded(String address, String entry) { }  // MT+addr<;>roster entry
     virtual void addressRemoved(String address, String command) { } // MT-addr<;>[dr]
     virtual void addressStealNeeded(String address, String entry) { } // MTSaddr<;>addr
+
+    // The speed and direction of the whole consist, when any member has
+    // reported a change.  After a speed, direction or emergency stop
+    // command, the report waits until every member has echoed it (or the
+    // settle timeout passes), so it describes the whole consist rather
+    // than the first member to answer.  The direction is that of the
+    // consist (inverted members have already been allowed for), and
+    // inStep is true when every member has reported the same speed and
+    // direction.
+    virtual void receivedConsistState(int speed, Direction direction, bool inStep) { }
+
+    virtual void receivedTurnoutState(String systemName, TurnoutState state) { }  // PTAnname
+    virtual void receivedRouteState(String systemName, RouteState state) { }      // PRAnname
+
+    // a setTurnout() or setRoute() has been confirmed by the server (or
+    // was not confirmed in time), latency is in milliseconds
+    virtual void turnoutCommandFinished(String systemName, bool confirmed, unsigned long latency) { }
+    virtual void routeCommandFinished(String systemName, bool confirmed, unsigned long latency) { }
+};
+
+
+// An input filter sees every byte read from the server before it is
+// split into lines, and can drop, pass or insert bytes.  This is where
+// the quirks of particular servers are handled.
+class WiThrottleInputFilter
+{
+  public:
+    static const size_t MAX_OUTPUT = 16;
+
+    virtual ~WiThrottleInputFilter() { }
+
+    // Called for each byte read.  Writes the bytes to pass on (at most
+    // MAX_OUTPUT) into out, and returns how many were written.
+    virtual size_t filter(char b, char *out) = 0;
+
+    // Called when a new connection is made.
+    virtual void reset() { }
 };
 
 
-class WiThrottleProtocol
+// Strips the ESP AT command noise sent by the Digitrax LnWi.
+class LnWiInputFilter : public WiThrottleInputFilter
+{
+  public:
+    LnWiInputFilter();
+
+    virtual size_t filter(char b, char *out);
+    virtual void reset();
+
+  private:
+    enum State {
+        LineStart,   // matching the start of a line against AT+CIPSENDBUF=
+        Passing,     // in the middle of an ordinary line
+        Dropping     // in the middle of an AT+ line
+    };
+
+    State state;
+    size_t matched;
+};
+
+
+// Where the library gets the time from.  The heartbeat, the fast clock,
+// momentum and the layout command timeouts all read it, so a replay or
+// a test can run the protocol on a clock of its own.
+class WiThrottleClock
+{
+  public:
+    virtual ~WiThrottleClock() { }
+
+    // milliseconds, from any starting point, wrapping as millis() does
+    virtual unsigned long now() = 0;
+};
+
+
+// Stands in for the console when none is given to begin(), so that the
+// log messages throughout the parser need no checks of their own.
+class WiThrottleNullStream : public Stream
+{
+  public:
+    virtual int available() { return 0; }
+    virtual int read() { return -1; }
+    virtual int peek() { return -1; }
+    virtual size_t write(uint8_t b) { return 1; }
+};
+
+// The console when logging is left out.  Every call is an empty inline
+// function, so the log messages cost nothing.
+class WiThrottleNullLog
 {
   public:
-    WiThrottleProtocol(bool server = false);
+    template<typename T> void print(T value) { }
+    template<typename T> void println(T value) { }
+    void println() { }
+    template<typename... Args> void printf(const char *format, Args... args) { }
+};
+
+
+// The rest of this file is the machinery behind BasicWiThrottleProtocol's
+// feature policy (see WiThrottleConfig.h); sketches don't use it directly.
+
+// Picks one of two overloads at compile time, so that the code for a
+// part that is turned off is never compiled.
+template<bool Enabled> struct WiThrottleFlag { };
+
+template<bool Condition, class IfTrue, class IfFalse>
+struct WiThrottleSelect { typedef IfTrue type; };
+template<class IfTrue, class IfFalse>
+struct WiThrottleSelect<false, IfTrue, IfFalse> { typedef IfFalse type; };
+
+
+// The state each part needs.  The protocol class inherits from all of
+// them, and a part that is turned off gets the empty version, which
+// takes no space.
+
+template<bool Enabled>
+struct WiThrottleServerState
+{
+    WiThrottleServerState(bool server) { }
+    bool isServer() const { return false; }
+};
+
+template<>
+struct WiThrottleServerState<true>
+{
+    WiThrottleServerState(bool server) : server(server) { }
+    bool isServer() const { return server; }
+
+    bool server;
+};
+
+
+template<int Size>
+struct WiThrottleBatchState
+{
+    bool batching;
+    char batch[Size];
+    size_t batchLength;
+};
+
+template<>
+struct WiThrottleBatchState<0> { };
+
+
+template<bool Enabled>
+struct WiThrottleFastClockState { };
+
+template<>
+struct WiThrottleFastClockState<true>
+{
+    unsigned long lastFastTimeTick;
+    double currentFastTime;
+    float currentFastTimeRate;
+};
+
+
+template<int Size>
+struct WiThrottleMessageSlot
+{
+    char type;
+    char text[Size];
+};
+
+template<class Features, bool Enabled = Features::messages>
+struct WiThrottleMessageState { };
+
+template<class Features>
+struct WiThrottleMessageState<Features, true>
+{
+    WiThrottleMessageSlot<Features::messageSize> messageSlots[Features::messageSlots];
+    uint8_t oldestMessage;
+    uint8_t messageCount;
+    unsigned long messagesEvicted;
+};
+
+
+// a turnout or route command waiting for the server to confirm it
+template<int NameSize>
+struct WiThrottlePendingCommand
+{
+    char systemName[NameSize];
+    bool inUse;
+    bool route;
+    uint8_t expectedState;  // 0 for any state (toggle)
+    unsigned long sentTime;
+};
+
+template<class Features, bool Enabled = Features::turnouts>
+struct WiThrottleLayoutState { };
+
+template<class Features>
+struct WiThrottleLayoutState<Features, true>
+{
+    static constexpr unsigned long DEFAULT_LAYOUT_COMMAND_TIMEOUT = 2000;  // milliseconds
+
+    WiThrottleLayoutState() : layoutCommandTimeout(DEFAULT_LAYOUT_COMMAND_TIMEOUT) {
+        // init() finishes anything left pending, so start with nothing
+        memset(pendingCommands, 0, sizeof(pendingCommands));
+    }
+
+    WiThrottlePendingCommand<Features::systemNameSize> pendingCommands[Features::maxPendingCommands];
+    unsigned long layoutCommandTimeout;
+};
+
+
+struct WiThrottleConsistMember
+{
+    char address[8];     // [S|L]nnnn
+    bool inverted;       // runs backwards relative to the consist
+    int speed;           // -1 until the server reports it
+    Direction direction; // the consist's direction, as this member last reported it
+    bool echoed;         // has reported since the last command to the whole consist
+    const uint8_t *speedCurve;  // NULL for a straight line
+    uint8_t speedCurvePoints;
+};
+
+template<class Features, bool Enabled = Features::throttle>
+struct WiThrottleThrottleState { };
+
+template<class Features>
+struct WiThrottleThrottleState<Features, true>
+{
+    static constexpr unsigned int DEFAULT_SPEED_INTERVAL = 100;  // milliseconds
+    static constexpr unsigned long DEFAULT_CONSIST_SETTLE_TIMEOUT = 250;  // milliseconds
+
+    WiThrottleThrottleState() :
+        consistCount(0),
+        consistChanged(false),
+        consistSettling(false),
+        consistCommandTime(0),
+        consistSettleTimeout(DEFAULT_CONSIST_SETTLE_TIMEOUT),
+        locomotiveSelected(false),
+        currentSpeed(0),
+        speedSteps(0),
+        currentDirection(Forward),
+        targetSpeed(0),
+        accelerationDelay(0),
+        decelerationDelay(0),
+        speedInterval(DEFAULT_SPEED_INTERVAL),
+        rampActive(false),
+        lastRampTime(0),
+        lastSpeedTime(0),
+        speedSent(false)
+    { }
+
+    WiThrottleConsistMember consist[Features::maxConsist];
+    int consistCount;
+    bool consistChanged;
+    bool consistSettling;  // waiting for every member to echo a command
+    unsigned long consistCommandTime;
+    unsigned long consistSettleTimeout;
+
+    bool locomotiveSelected;
+
+    String currentAddress;
+
+    int currentSpeed;
+    int speedSteps;  // 1=128, 2=28, 4=27, 8=14, 16=28Mot
+    Direction currentDirection;
+
+    int targetSpeed;
+    unsigned int accelerationDelay;
+    unsigned int decelerationDelay;
+    unsigned int speedInterval;
+    bool rampActive;
+    unsigned long lastRampTime;
+    unsigned long lastSpeedTime;
+    bool speedSent;  // since connecting, so lastSpeedTime means something
+};
+
+
+// A WiThrottle connection, built with the parts of the library that
+// Features asks for (see WiThrottleConfig.h).  Calling a method that
+// belongs to a part that is turned off is a compile error.
+template<class Features>
+class BasicWiThrottleProtocol :
+    private WiThrottleServerState<Features::server>,
+    private WiThrottleBatchState<Features::batchSize>,
+    private WiThrottleFastClockState<Features::fastClock>,
+    private WiThrottleMessageState<Features>,
+    private WiThrottleLayoutState<Features>,
+    private WiThrottleThrottleState<Features>
+{
+  public:
+    BasicWiThrottleProtocol(bool server = false);
 
     void begin(Stream *console);
 
+    void setInputFilter(WiThrottleInputFilter *filter);
+    void setClock(WiThrottleClock *clock);  // NULL for millis()
+
     void connect(Stream *stream);
+    void connect(Stream *stream, const WiThrottleConnectOptions& options);
     void disconnect();
 
+    bool isSessionReady();
+    unsigned long timeToSessionReady();  // milliseconds from connect()
+
     void setDeviceName(String deviceName);
     void setDeviceID(String deviceId);
 
     bool check();
 
+    // fast clock
     int fastTimeHours();
     int fastTimeMinutes();
     float fastTimeRate();
@@ -93,6 +441,24 @@ class WiThrottleProtocol
     void requireHeartbeat(bool needed=true);
     bool heartbeatChanged;
 
+    // messages: takes the oldest unread server message.  The text stays
+    // good until the next call to check().
+    bool nextServerMessage(ServerMessageType *type, const char **text);
+    int serverMessagesWaiting();
+    unsigned long serverMessagesEvicted();
+
+    // batchSize > 0: commands sent between these calls go to the server
+    // in one write
+    void beginBatch();
+    void endBatch();
+
+    // turnouts
+    bool setTurnout(String systemName, TurnoutAction action);
+    bool setRoute(String systemName);
+    void setLayoutCommandTimeout(unsigned long timeout);  // milliseconds
+    int pendingLayoutCommands();
+
+    // throttle
     bool addLocomotive(String address);  // address is [S|L]nnnn (where n is 0-10000)
     bool stealLocomotive(String address);   // address is [S|L]nnnn (where n is 0-10000)
     bool releaseLocomotive(String address = "*");
@@ -101,62 +467,168 @@ class WiThrottleProtocol
 
     bool setSpeed(int speed);
     int getSpeed();
+
+    bool setTargetSpeed(int throttle);  // ramped, through the speed curve
+    int getTargetSpeed();
+    void setMomentum(unsigned int acceleration, unsigned int deceleration);  // ms per notch
+    void setMaxSpeedRate(unsigned int interval);  // ms between speed commands
+    // a speed curve belongs to one locomotive, and the lead's is used
+    // for the whole consist
+    bool setSpeedCurve(const uint8_t *curve, uint8_t points);  // the lead
+    bool setSpeedCurve(String address, const uint8_t *curve, uint8_t points);
+
     bool setDirection(Direction direction);
     Direction getDirection();
 
+    // every locomotive added is a member of the consist, the first
+    // being the lead
+    bool setConsistMemberInverted(String address, bool inverted);
+    int consistSize();
+    const char *consistMemberAddress(int member);
+    bool consistMemberInverted(int member);
+    int consistMemberSpeed(int member);  // as last reported by the server, -1 if not yet
+    void setConsistSettleTimeout(unsigned long timeout);  // milliseconds
+
     void emergencyStop();
 
     WiThrottleProtocolDelegate *delegate = NULL;
 
   private:
-    bool server;
+    typedef WiThrottleFlag<Features::fastClock> HasFastClock;
+    typedef WiThrottleFlag<Features::throttle> HasThrottle;
+    typedef WiThrottleFlag<Features::turnouts> HasTurnouts;
+    typedef WiThrottleFlag<Features::messages> HasMessages;
+    typedef WiThrottleFlag<Features::logging> HasLogging;
+    typedef WiThrottleFlag<(Features::batchSize > 0)> HasBatch;
+
+    typedef typename WiThrottleSelect<Features::logging, Stream, WiThrottleNullLog>::type Log;
+    typedef WiThrottleMessageSlot<Features::messageSize> MessageSlot;
+    typedef WiThrottlePendingCommand<Features::systemNameSize> PendingCommand;
+    typedef WiThrottleConsistMember ConsistMember;
+
+    static const int MIN_SPEED = 0;
+    static const int MAX_SPEED = 126;
+
+    static Log *nullConsole();
+    void setConsole(WiThrottleFlag<true>, Stream *console);
+    void setConsole(WiThrottleFlag<false>, Stream *console) { }
+
     Stream *stream;
-    Stream *console;
+    Log *console;
+    WiThrottleInputFilter *inputFilter;
+    WiThrottleClock *clock;
 
+    unsigned long clockMillis();
+
+    bool processByte(char b);
     bool processCommand(char *c, int len);
-    bool processLocomotiveAction(char *c, int len);
-    bool processFastTime(char *c, int len);
     bool processHeartbeat(char *c, int len);
     void processProtocolVersion(char *c, int len);
     void processWebPort(char *c, int len);
     void processTrackPower(char *c, int len);
-    void processFunctionState(const String& functionData);
-    void processSpeedSteps(const String& speedStepData);
-    void processDirection(const String& speedStepData);
-    void processSpeed(const String& speedData);
-    void processAddRemove(char *c, int len);
-    void processStealNeeded(char *c, int len);
-
-    bool checkFastTime();
+
     bool checkHeartbeat();
 
-    void sendCommand(String cmd);
+    void sendCommand(const String& cmd);
+    void sendCommand(const char *cmd);
+    void sendCommands(const char *cmds, size_t length);
 
-    void setCurrentFastTime(const String& s);
+    // false when not batching, or batching is left out
+    bool batchCommand(WiThrottleFlag<true>, const char *text);
+    bool batchCommand(WiThrottleFlag<false>, const char *text) { return false; }
+    void resetBatch(WiThrottleFlag<true>);
+    void resetBatch(WiThrottleFlag<false>) { }
+    void addToBatch(const char *text);
+    void writeBatch();
 
-    char inputbuffer[1024];
+    char inputbuffer[Features::inputBufferSize];
     ssize_t nextChar;  // where the next character to be read goes in the buffer
 
-    Chrono heartbeatTimer;
+    unsigned long lastHeartbeatTime;
     int heartbeatPeriod;
 
-    Chrono fastTimeTimer;
-    double currentFastTime;
-    float currentFastTimeRate;
-
     void resetChangeFlags();
 
-    void init();
+    void receivedGreeting(uint8_t greeting);
 
-    bool locomotiveSelected = false;
+    uint8_t greetingsReceived;
+    uint8_t readyWhen;
+    bool sessionIsReady;
+    unsigned long connectTime;
+    unsigned long sessionReadyTime;
 
-    String currentAddress;
+    void init();
 
-    int currentSpeed;
-    int speedSteps;  // 1=128, 2=28, 4=27, 8=14, 16=28Mot
-    Direction currentDirection;
+    // fast clock
+    void resetFastClock(WiThrottleFlag<true>);
+    void resetFastClock(WiThrottleFlag<false>) { }
+    void startFastClock(WiThrottleFlag<true>);
+    void startFastClock(WiThrottleFlag<false>) { }
+    bool processFastTime(WiThrottleFlag<true>, char *c, int len);
+    bool processFastTime(WiThrottleFlag<false>, char *c, int len) { return false; }
+    bool checkFastTime(WiThrottleFlag<true>);
+    bool checkFastTime(WiThrottleFlag<false>) { return false; }
+    void setCurrentFastTime(long t);
+
+    // messages
+    void resetMessages(WiThrottleFlag<true>);
+    void resetMessages(WiThrottleFlag<false>) { }
+    void processServerMessage(WiThrottleFlag<true>, char *c, int len);
+    void processServerMessage(WiThrottleFlag<false>, char *c, int len) { }
+
+    // turnouts
+    void resetLayoutCommands(WiThrottleFlag<true>);
+    void resetLayoutCommands(WiThrottleFlag<false>) { }
+    void processTurnoutState(WiThrottleFlag<true>, char *c, int len);
+    void processTurnoutState(WiThrottleFlag<false>, char *c, int len) { }
+    void processRouteState(WiThrottleFlag<true>, char *c, int len);
+    void processRouteState(WiThrottleFlag<false>, char *c, int len) { }
+    bool checkLayoutCommands(WiThrottleFlag<true>);
+    bool checkLayoutCommands(WiThrottleFlag<false>) { return false; }
+    static bool isLayoutState(char c);
+    bool sendLayoutCommand(const char *prefix, const String& systemName,
+                           bool route, uint8_t expectedState);
+    void confirmLayoutCommand(const char *systemName, bool route, uint8_t state);
+    void finishLayoutCommand(PendingCommand& pending, bool confirmed, unsigned long now);
+
+    // throttle
+    void resetThrottle(WiThrottleFlag<true>);
+    void resetThrottle(WiThrottleFlag<false>) { }
+    void selectOnConnect(WiThrottleFlag<true>, const String& address, String& handshake);
+    void selectOnConnect(WiThrottleFlag<false>, const String& address, String& handshake) { }
+    bool processLocomotiveAction(WiThrottleFlag<true>, char *c, int len);
+    bool processLocomotiveAction(WiThrottleFlag<false>, char *c, int len) { return false; }
+    void processAddRemove(WiThrottleFlag<true>, char *c, int len);
+    void processAddRemove(WiThrottleFlag<false>, char *c, int len) { }
+    void reportAddRemove(char *c, int len);
+    void processStealNeeded(WiThrottleFlag<true>, char *c, int len);
+    void processStealNeeded(WiThrottleFlag<false>, char *c, int len) { }
+    bool checkMomentum(WiThrottleFlag<true>);
+    bool checkMomentum(WiThrottleFlag<false>) { return false; }
+    bool checkConsist(WiThrottleFlag<true>);
+    bool checkConsist(WiThrottleFlag<false>) { return false; }
+
+    void processFunctionState(char *c, int len);
+    void processSpeedSteps(char *c, int len);
+    void processDirection(char *c, int len);
+    void processSpeed(char *c, int len);
+
+    bool addConsistMember(const String& address);
+    void removeConsistMember(const char *address, int length);
+    int findConsistMember(const char *address, int length);
+    void processMemberAction(int member, char *c, int len);
+    void reportConsistState();
+    void startConsistSettle();
+
+    void sendSpeed(int speed);
+    int applySpeedCurve(int throttle);
+    const uint8_t *speedTable(int *notches);
 };
 
 
+typedef BasicWiThrottleProtocol<WiThrottleFeatures> WiThrottleProtocol;
+
+
+#include "WiThrottleProtocolImpl.h"
 
 #endif // WITHROTTLE_H
@@ -0,0 +1,1905 @@
+/* -*- c++ -*-
+ *
+ * WiThrottleProtocolImpl
+ *
+ * The methods of BasicWiThrottleProtocol.  They are templates, so they
+ * live in a header and are compiled along with the sketch, for whichever
+ * feature policies it uses; WiThrottleProtocol.h includes this file, and
+ * sketches never need to.
+ *
+ * Copyright © 2018-2019, 2021 Blue Knobby Systems Inc.
+ *
+ * This work is licensed under the Creative Commons Attribution-ShareAlike
+ * 4.0 International License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-sa/4.0/ or send a letter to
+ * Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+ *
+ * Attribution — You must give appropriate credit, provide a link to the
+ * license, and indicate if changes were made. You may do so in any
+ * reasonable manner, but not in any way that suggests the licensor
+ * endorses you or your use.
+ *
+ * ShareAlike — If you remix, transform, or build upon the material, you
+ * must distribute your contributions under the same license as the
+ * original.
+ *
+ * All other rights reserved.
+ *
+ */
+
+#ifndef WITHROTTLE_IMPL_H
+#define WITHROTTLE_IMPL_H
+
+#include <ArduinoTime.h>
+#include <TimeLib.h>
+
+
+// these are #undef'd at the end of the file, to keep them out of sketches
+#define NEWLINE '\n'
+#define CR '\r'
+#define PROPERTY_SEPARATOR "<;>"
+
+
+// The V value sent for each notch, for the speed step modes that have
+// fewer notches than there are V values.  Momentum steps from notch to
+// notch so that every intermediate command changes what the decoder does.
+// Defined in WiThrottleProtocol.cpp, so there is one copy however many
+// feature policies a sketch uses.
+struct WiThrottleSpeedTables
+{
+    static constexpr uint8_t steps28[] = {
+        0, 5, 9, 14, 18, 23, 27, 32, 36, 41, 45, 50, 54, 59, 63,
+        68, 72, 77, 81, 86, 90, 95, 99, 104, 108, 113, 117, 122, 126
+    };
+    static constexpr uint8_t steps27[] = {
+        0, 5, 9, 14, 19, 23, 28, 33, 37, 42, 47, 51, 56, 61,
+        65, 70, 75, 79, 84, 89, 93, 98, 103, 107, 112, 117, 121, 126
+    };
+    static constexpr uint8_t steps14[] = {
+        0, 9, 18, 27, 36, 45, 54, 63, 72, 81, 90, 99, 108, 117, 126
+    };
+};
+
+static_assert(sizeof(WiThrottleSpeedTables::steps28) == 29, "28 step table needs 29 entries");
+static_assert(sizeof(WiThrottleSpeedTables::steps27) == 28, "27 step table needs 28 entries");
+static_assert(sizeof(WiThrottleSpeedTables::steps14) == 15, "14 step table needs 15 entries");
+
+
+template<class Features> const int BasicWiThrottleProtocol<Features>::MIN_SPEED;
+template<class Features> const int BasicWiThrottleProtocol<Features>::MAX_SPEED;
+
+
+template<class Features>
+BasicWiThrottleProtocol<Features>::BasicWiThrottleProtocol(bool server):
+    WiThrottleServerState<Features::server>(server),
+    console(nullConsole()),
+    inputFilter(NULL),
+    clock(NULL)
+{
+    init();
+}
+
+
+template<class Features>
+typename BasicWiThrottleProtocol<Features>::Log *
+BasicWiThrottleProtocol<Features>::nullConsole()
+{
+    static typename WiThrottleSelect<Features::logging, WiThrottleNullStream, WiThrottleNullLog>::type none;
+    return &none;
+}
+
+template<class Features>
+void
+BasicWiThrottleProtocol<Features>::init()
+{
+    stream = NULL;
+    memset(inputbuffer, 0, sizeof(inputbuffer));
+    nextChar = 0;
+    lastHeartbeatTime = 0;
+    heartbeatPeriod = 0;
+    resetBatch(HasBatch());
+    resetMessages(HasMessages());
+    resetLayoutCommands(HasTurnouts());
+    resetFastClock(HasFastClock());
+    resetThrottle(HasThrottle());
+    greetingsReceived = 0;
+    readyWhen = DEFAULT_READY_WHEN;
+    sessionIsReady = false;
+    connectTime = 0;
+    sessionReadyTime = 0;
+    resetChangeFlags();
+}
+
+template<class Features>
+void
+BasicWiThrottleProtocol<Features>::begin(Stream *console)
+{
+    setConsole(HasLogging(), console);
+}
+
+
+template<class Features>
+void
+BasicWiThrottleProtocol<Features>::setConsole(WiThrottleFlag<true>, Stream *console)
+{
+    this->console = console ? console : nullConsole();
+}
+
+
+template<class Features>
+void
+BasicWiThrottleProtocol<Features>::resetChangeFlags()
+{
+    clockChanged = false;
+    heartbeatChanged = false;
+}
+
+template<class Features>
+void
+BasicWiThrottleProtocol<Features>::setInputFilter(WiThrottleInputFilter *filter)
+{
+    inputFilter = filter;
+    if (inputFilter) {
+        inputFilter->reset();
+    }
+}
+
+template<class Features>
+void
+BasicWiThrottleProtocol<Features>::setClock(WiThrottleClock *clock)
+{
+    this->clock = clock;
+}
+
+template<class Features>
+unsigned long
+BasicWiThrottleProtocol<Features>::clockMillis()
+{
+    return clock ? clock->now() : millis();
+}
+
+template<class Features>
+void
+BasicWiThrottleProtocol<Features>::connect(Stream *stream)
+{
+    init();
+    if (inputFilter) {
+        inputFilter->reset();
+    }
+    this->stream = stream;
+    connectTime = clockMillis();
+    lastHeartbeatTime = connectTime;
+    startFastClock(HasFastClock());
+}
+
+template<class Features>
+void
+BasicWiThrottleProtocol<Features>::connect(Stream *stream, const WiThrottleConnectOptions& options)
+{
+    connect(stream);
+    readyWhen = options.readyWhen;
+
+    // the whole handshake goes out in a single write, rather than
+    // waiting for each command to be sent in turn
+    String handshake;
+    if (options.deviceName.length() > 0) {
+        handshake += "N" + options.deviceName + "\r\n";
+    }
+    if (options.deviceID.length() > 0) {
+        handshake += "H" + options.deviceID + "\r\n";
+    }
+    if (options.requireHeartbeat) {
+        handshake += "*+\r\n";
+    }
+
+    selectOnConnect(HasThrottle(), options.locomotive, handshake);
+
+    if (handshake.length() > 0) {
+        stream->write((const uint8_t *) handshake.c_str(), handshake.length());
+        console->print("==> "); console->print(handshake);
+    }
+}
+
+template<class Features>
+bool
+BasicWiThrottleProtocol<Features>::isSessionReady()
+{
+    return sessionIsReady;
+}
+
+template<class Features>
+unsigned long
+BasicWiThrottleProtocol<Features>::timeToSessionReady()
+{
+    return sessionReadyTime;
+}
+
+template<class Features>
+void
+BasicWiThrottleProtocol<Features>::receivedGreeting(uint8_t greeting)
+{
+    greetingsReceived |= greeting;
+
+    if (!sessionIsReady && (greetingsReceived & readyWhen) == readyWhen) {
+        sessionIsReady = true;
+        sessionReadyTime = clockMillis() - connectTime;
+        console->printf("session ready after %lu ms\n", sessionReadyTime);
+        if (delegate) {
+            delegate->sessionReady();
+        }
+    }
+}
+
+template<class Features>
+void
+BasicWiThrottleProtocol<Features>::disconnect()
+{
+    this->stream = NULL;
+}
+
+template<class Features>
+void
+BasicWiThrottleProtocol<Features>::setDeviceName(String deviceName)
+{
+    String command = "N" + deviceName;
+    sendCommand(command);
+}
+
+template<class Features>
+void
+BasicWiThrottleProtocol<Features>::setDeviceID(String deviceId)
+{
+    String command = "H" + deviceId;
+    sendCommand(command);
+}
+
+
+template<class Features>
+bool
+BasicWiThrottleProtocol<Features>::check()
+{
+    bool changed = false;
+    resetChangeFlags();
+
+    if (stream) {
+        // update the fast clock first
+        changed |= checkFastTime(HasFastClock());
+        changed |= checkHeartbeat();
+        changed |= checkLayoutCommands(HasTurnouts());
+        changed |= checkMomentum(HasThrottle());
+
+        while(stream->available()) {
+            char b = stream->read();
+            if (inputFilter) {
+                char filtered[WiThrottleInputFilter::MAX_OUTPUT];
+                size_t count = inputFilter->filter(b, filtered);
+                for (size_t i = 0; i < count; i++) {
+                    changed |= processByte(filtered[i]);
+                }
+            }
+            else {
+                changed |= processByte(b);
+            }
+        }
+
+        changed |= checkConsist(HasThrottle());
+
+        return changed;
+
+    }
+    else {
+        return false;
+    }
+}
+
+template<class Features>
+bool
+BasicWiThrottleProtocol<Features>::processByte(char b)
+{
+    bool changed = false;
+
+    if (b == NEWLINE || b == CR) {
+        // server sends TWO newlines after each command, we trigger on the
+        // first, and this skips the second one
+        if (nextChar != 0) {
+            inputbuffer[nextChar] = 0;
+            changed = processCommand(inputbuffer, nextChar);
+        }
+        nextChar = 0;
+    }
+    else if (b == 0) {
+        // a NUL would silently truncate the line, so drop it
+    }
+    else {
+        inputbuffer[nextChar] = b;
+        nextChar += 1;
+        if (nextChar == sizeof(inputbuffer) - 1) {
+            inputbuffer[nextChar] = 0;
+            console->print("ERROR LINE TOO LONG: ");
+            console->println(inputbuffer);
+            nextChar = 0;
+        }
+    }
+
+    return changed;
+}
+
+template<class Features>
+void
+BasicWiThrottleProtocol<Features>::sendCommand(const String& cmd)
+{
+    sendCommand(cmd.c_str());
+}
+
+template<class Features>
+void
+BasicWiThrottleProtocol<Features>::sendCommand(const char *cmd)
+{
+    if (stream) {
+        if (batchCommand(HasBatch(), cmd)) {
+            batchCommand(HasBatch(), "\r\n");
+            if (this->isServer()) {
+                batchCommand(HasBatch(), "\r\n");
+            }
+        }
+        else {
+            // TODO: what happens when the write fails?
+            stream->println(cmd);
+            if (this->isServer()) {
+                stream->println("");
+            }
+        }
+        console->print("==> "); console->println(cmd);
+    }
+}
+
+
+// cmds is one or more commands, each already followed by its line ending
+template<class Features>
+void
+BasicWiThrottleProtocol<Features>::sendCommands(const char *cmds, size_t length)
+{
+    if (stream) {
+        if (!batchCommand(HasBatch(), cmds)) {
+            stream->write((const uint8_t *) cmds, length);
+        }
+        console->print("==> "); console->print(cmds);
+    }
+}
+
+
+template<class Features>
+void
+BasicWiThrottleProtocol<Features>::beginBatch()
+{
+    static_assert(Features::batchSize > 0, "beginBatch() needs a batchSize");
+    this->batching = true;
+}
+
+
+template<class Features>
+void
+BasicWiThrottleProtocol<Features>::endBatch()
+{
+    static_assert(Features::batchSize > 0, "endBatch() needs a batchSize");
+    this->batching = false;
+    writeBatch();
+}
+
+
+template<class Features>
+void
+BasicWiThrottleProtocol<Features>::resetBatch(WiThrottleFlag<true>)
+{
+    this->batching = false;
+    this->batchLength = 0;
+}
+
+
+template<class Features>
+bool
+BasicWiThrottleProtocol<Features>::batchCommand(WiThrottleFlag<true>, const char *text)
+{
+    if (!this->batching) {
+        return false;
+    }
+    addToBatch(text);
+    return true;
+}
+
+
+template<class Features>
+void
+BasicWiThrottleProtocol<Features>::addToBatch(const char *text)
+{
+    // a full batch goes out early, rather than anything being lost
+    size_t length = strlen(text);
+    if (this->batchLength + length > sizeof(this->batch)) {
+        writeBatch();
+    }
+    if (length > sizeof(this->batch)) {
+        stream->write((const uint8_t *) text, length);
+        return;
+    }
+    memcpy(this->batch + this->batchLength, text, length);
+    this->batchLength += length;
+}
+
+
+template<class Features>
+void
+BasicWiThrottleProtocol<Features>::writeBatch()
+{
+    if (stream && this->batchLength > 0) {
+        stream->write((const uint8_t *) this->batch, this->batchLength);
+    }
+    this->batchLength = 0;
+}
+
+
+template<class Features>
+void
+BasicWiThrottleProtocol<Features>::resetFastClock(WiThrottleFlag<true>)
+{
+    this->lastFastTimeTick = 0;
+    this->currentFastTime = 0.0;
+    this->currentFastTimeRate = 0.0;
+}
+
+
+template<class Features>
+void
+BasicWiThrottleProtocol<Features>::startFastClock(WiThrottleFlag<true>)
+{
+    this->lastFastTimeTick = connectTime;
+}
+
+
+template<class Features>
+bool
+BasicWiThrottleProtocol<Features>::checkFastTime(WiThrottleFlag<true>)
+{
+    bool changed = true;
+    // whole real seconds since the last tick; more than one if check()
+    // has not been called for a while, or the clock has jumped
+    unsigned long seconds = (clockMillis() - this->lastFastTimeTick) / 1000;
+    if (seconds > 0) {
+        this->lastFastTimeTick += seconds * 1000;
+        if (this->currentFastTimeRate == 0.0) {
+            clockChanged = false;
+        }
+        else {
+            this->currentFastTime += this->currentFastTimeRate * seconds;
+            clockChanged = true;
+        }
+    }
+
+    return changed;
+}
+
+
+template<class Features>
+int
+BasicWiThrottleProtocol<Features>::fastTimeHours()
+{
+    static_assert(Features::fastClock, "fastTimeHours() needs Features::fastClock");
+    time_t now = (time_t) this->currentFastTime;
+    return hour(now);
+}
+
+
+template<class Features>
+int
+BasicWiThrottleProtocol<Features>::fastTimeMinutes()
+{
+    static_assert(Features::fastClock, "fastTimeMinutes() needs Features::fastClock");
+    time_t now = (time_t) this->currentFastTime;
+    return minute(now);
+}
+
+
+template<class Features>
+float
+BasicWiThrottleProtocol<Features>::fastTimeRate()
+{
+    static_assert(Features::fastClock, "fastTimeRate() needs Features::fastClock");
+    return this->currentFastTimeRate;
+}
+
+
+template<class Features>
+bool
+BasicWiThrottleProtocol<Features>::processLocomotiveAction(WiThrottleFlag<true>, char *c, int len)
+{
+    // the leading "MTA" was not passed to this method
+
+    if (this->currentAddress.length() == 0) {
+        //console->printf("  skipping due to no selected address\n");
+        return true;
+    }
+
+    const char *separator = strstr(c, PROPERTY_SEPARATOR);
+    if (separator == NULL) {
+        console->printf("insufficient action to process\n");
+        return false;
+    }
+
+    int addressLength = separator - c;
+    bool allAddresses = (addressLength == 1 && c[0] == '*');
+    bool ourAddress = (addressLength == (int) this->currentAddress.length() &&
+                       strncmp(c, this->currentAddress.c_str(), addressLength) == 0);
+    int member = allAddresses ? -1 : findConsistMember(c, addressLength);
+    if (!allAddresses && !ourAddress && member < 0) {
+        // an action for some other address
+        return false;
+    }
+
+    char *remainder = c + addressLength + strlen(PROPERTY_SEPARATOR);
+    int remainderLength = len - (remainder - c);
+
+    if (remainderLength > 0) {
+        if (allAddresses) {
+            for (int i = 0; i < this->consistCount; i++) {
+                processMemberAction(i, remainder, remainderLength);
+            }
+        }
+        else if (member >= 0) {
+            processMemberAction(member, remainder, remainderLength);
+        }
+
+        if (!allAddresses && !ourAddress) {
+            // the rest of the consist only counts towards the consist state
+            return true;
+        }
+
+        char action = remainder[0];
+
+        switch (action) {
+            case 'F':
+                processFunctionState(remainder, remainderLength);
+                break;
+            case 'V':
+                processSpeed(remainder, remainderLength);
+                break;
+            case 's':
+                processSpeedSteps(remainder, remainderLength);
+                break;
+            case 'R':
+                processDirection(remainder, remainderLength);
+                break;
+            default:
+                console->printf("unrecognized action '%c'\n", action);
+                // no processing on unrecognized actions
+                break;
+        }
+        return true;
+    }
+    else {
+        console->printf("insufficient action to process\n");
+        return false;
+    }
+}
+
+
+template<class Features>
+bool
+BasicWiThrottleProtocol<Features>::processCommand(char *c, int len)
+{
+    console->print("<== ");
+    console->println(c);
+
+    if (Features::fastClock && len > 3 && c[0]=='P' && c[1]=='F' && c[2]=='T') {
+        return processFastTime(HasFastClock(), c+3, len-3);
+    }
+    else if (len > 3 && c[0]=='P' && c[1]=='P' && c[2]=='A') {
+        processTrackPower(c+3, len-3);
+        receivedGreeting(GreetingTrackPower);
+        return true;
+    }
+    else if (len > 1 && c[0]=='*') {
+        receivedGreeting(GreetingHeartbeat);
+        return processHeartbeat(c+1, len-1);
+    }
+    else if (len > 2 && c[0]=='V' && c[1]=='N') {
+        processProtocolVersion(c+2, len-2);
+        receivedGreeting(GreetingVersion);
+        return true;
+    }
+    else if (len > 2 && c[0]=='R' && c[1]=='L') {
+        // the roster list itself isn't parsed (yet)
+        receivedGreeting(GreetingRoster);
+        return true;
+    }
+    else if (len > 2 && c[0]=='P' && c[1]=='W') {
+        processWebPort(c+2, len-2);
+        receivedGreeting(GreetingWebPort);
+        return true;
+    }
+    else if (Features::throttle && len > 6 && c[0]=='M' && c[1]=='T' && c[2]=='S') {
+        processStealNeeded(HasThrottle(), c+3, len-3);
+        return true;
+    }
+    else if (Features::throttle && len > 6 && c[0]=='M' && c[1]=='T' && (c[2]=='+' || c[2]=='-')) {
+        // we want to make sure the + or - is passed in as part of the string to process
+        processAddRemove(HasThrottle(), c+2, len-2);
+        return true;
+    }
+    else if (Features::throttle && len > 8 && c[0]=='M' && c[1]=='T' && c[2]=='A') {
+        return processLocomotiveAction(HasThrottle(), c+3, len-3);
+    }
+    else if (Features::messages && len > 2 && c[0]=='H' &&
+             (c[1]=='M' || c[1]=='m' || c[1]=='T' || c[1]=='t')) {
+        processServerMessage(HasMessages(), c+1, len-1);
+        return true;
+    }
+    else if (Features::turnouts && len > 4 && c[0]=='P' && c[1]=='T' && c[2]=='A') {
+        processTurnoutState(HasTurnouts(), c+3, len-3);
+        return true;
+    }
+    else if (Features::turnouts && len > 4 && c[0]=='P' && c[1]=='R' && c[2]=='A') {
+        processRouteState(HasTurnouts(), c+3, len-3);
+        return true;
+    }
+    else {
+        console->printf("unknown command '%s'\n", c);
+        // all other commands are explicitly ignored
+        return false;
+    }
+}
+
+
+
+template<class Features>
+void
+BasicWiThrottleProtocol<Features>::setCurrentFastTime(long t)
+{
+    if (this->currentFastTime == 0.0) {
+        console->print("set fast time to "); console->println(t);
+    }
+    else {
+        console->print("updating fast time (should be "); console->print(t);
+        console->print(" is "); console->print(this->currentFastTime);  console->println(")");
+        console->printf("currentTime is %lu\n", (unsigned long) clockMillis());
+    }
+    this->currentFastTime = t;
+}
+
+
+template<class Features>
+bool
+BasicWiThrottleProtocol<Features>::processFastTime(WiThrottleFlag<true>, char *c, int len)
+{
+    // keep this style -- I don't validate the settings and syntax
+    // as well as I could, so someday we might return false
+
+    bool changed = false;
+
+    // atol stops at the separator, so the time needs no copy of its own
+    setCurrentFastTime(atol(c));
+    changed = true;
+
+    const char *separator = strstr(c, PROPERTY_SEPARATOR);
+    if (separator != NULL && separator != c) {
+        this->currentFastTimeRate = atof(separator + strlen(PROPERTY_SEPARATOR));
+        console->print("set clock rate to "); console->println(this->currentFastTimeRate);
+        clockChanged = true;
+    }
+
+    return changed;
+}
+
+
+template<class Features>
+bool
+BasicWiThrottleProtocol<Features>::processHeartbeat(char *c, int len)
+{
+    bool changed = false;
+
+    heartbeatPeriod = atoi(c);
+    if (heartbeatPeriod > 0) {
+        heartbeatChanged = true;
+        changed = true;
+        if (delegate) {
+            delegate->heartbeatConfig(heartbeatPeriod);
+        }
+    }
+    return changed;
+}
+
+
+template<class Features>
+void
+BasicWiThrottleProtocol<Features>::processProtocolVersion(char *c, int len)
+{
+    if (delegate && len > 0) {
+        String protocolVersion = String(c);
+        delegate->receivedVersion(protocolVersion);
+    }
+}
+
+template<class Features>
+void
+BasicWiThrottleProtocol<Features>::processWebPort(char *c, int len)
+{
+    if (delegate && len > 0) {
+        delegate->receivedWebPort(atoi(c));
+    }
+}
+
+
+
+// the string passed in will look 'F03' (meaning turn off Function 3) or
+// 'F112' (turn on function 12)
+template<class Features>
+void
+BasicWiThrottleProtocol<Features>::processFunctionState(char *c, int len)
+{
+    // F[0|1]nn - where nn is 0-28
+    if (delegate && len >= 3) {
+        bool state = c[1]=='1' ? true : false;
+
+        char *end;
+        long funcNum = strtol(c+2, &end, 10);
+
+        if (end == c+2 || funcNum < 0 || funcNum > 255) {
+            // error in parsing
+        }
+        else {
+            delegate->receivedFunctionState(funcNum, state);
+        }
+    }
+}
+
+
+template<class Features>
+void
+BasicWiThrottleProtocol<Features>::processSpeed(char *c, int len)
+{
+    if (delegate && len >= 2) {
+        int speed = atoi(c+1);
+
+        if ((speed < MIN_SPEED) || (speed > MAX_SPEED)) {
+            speed = 0;
+        }
+
+        delegate->receivedSpeed(speed);
+    }
+}
+
+
+template<class Features>
+void
+BasicWiThrottleProtocol<Features>::processSpeedSteps(char *c, int len)
+{
+    if (len >= 2) {
+        int steps = atoi(c+1);
+
+        if (steps != 1 && steps != 2 && steps != 4 && steps != 8 && steps !=16) {
+            // error, not one of the known values
+        }
+        else {
+            this->speedSteps = steps;
+            if (delegate) {
+                delegate->receivedSpeedSteps(steps);
+            }
+        }
+    }
+}
+
+
+template<class Features>
+void
+BasicWiThrottleProtocol<Features>::processDirection(char *c, int len)
+{
+    // R[0|1]
+    if (delegate && len == 2) {
+        if (c[1] == '0') {
+            this->currentDirection = Reverse;
+        }
+        else {
+            this->currentDirection = Forward;
+        }
+
+        delegate->receivedDirection(this->currentDirection);
+    }
+}
+
+
+template<class Features>
+void
+BasicWiThrottleProtocol<Features>::processTrackPower(char *c, int len)
+{
+    if (delegate) {
+        if (len > 0) {
+            TrackPower state = PowerUnknown;
+            if (c[0]=='0') {
+                state = PowerOff;
+            }
+            else if (c[0]=='1') {
+                state = PowerOn;
+            }
+
+            delegate->receivedTrackPower(state);
+        }
+    }
+}
+
+
+template<class Features>
+void
+BasicWiThrottleProtocol<Features>::processAddRemove(WiThrottleFlag<true>, char *c, int len)
+{
+    // [+|-]addr<;>...
+    const char *separator = strstr(c+1, PROPERTY_SEPARATOR);
+    size_t addressLength = separator ? separator - (c+1) : strlen(c+1);
+    if (c[0] == '-' && separator != NULL) {
+        removeConsistMember(c+1, addressLength);
+    }
+
+    reportAddRemove(c, len);
+
+    // only the locomotive asked for when connecting completes the greeting
+    if (c[0] == '+' && addressLength == this->currentAddress.length() &&
+        strncmp(c+1, this->currentAddress.c_str(), addressLength) == 0) {
+        receivedGreeting(GreetingLocomotive);
+    }
+}
+
+
+template<class Features>
+void
+BasicWiThrottleProtocol<Features>::reportAddRemove(char *c, int len)
+{
+    if (!delegate) {
+        // If no one is listening, don't do the work to parse the string
+        return;
+    }
+
+    //console->printf("processing add/remove command %s\n", c);
+
+    String s(c);
+
+    bool add = (c[0] == '+');
+    bool remove = (c[0] == '-');
+
+    int p = s.indexOf(PROPERTY_SEPARATOR);
+    if (p > 0) {
+        String address = s.substring(1, p);
+        String entry   = s.substring(p + strlen(PROPERTY_SEPARATOR));
+
+        address.trim();
+        entry.trim();
+
+        if (add) {
+            delegate->addressAdded(address, entry);
+        }
+        if (remove) {
+            // the entry has already been trimmed of the line ending
+            if (entry.equals("d") || entry.equals("r")) {
+                delegate->addressRemoved(address, entry);
+            }
+            else {
+                console->printf("malformed address removal: command is '%s'\n", entry.c_str());
+            }
+        }
+    }
+
+
+}
+
+
+template<class Features>
+void
+BasicWiThrottleProtocol<Features>::processStealNeeded(WiThrottleFlag<true>, char *c, int len)
+{
+    if (!delegate) {
+        // If no one is listening, don't do the work to parse the string
+        return;
+    }
+
+    console->printf("processing steal needed command %s\n", c);
+
+    String s(c);
+
+    int p = s.indexOf(PROPERTY_SEPARATOR);
+    if (p > 0) {
+        String address = s.substring(0, p);
+        String entry   = s.substring(p + strlen(PROPERTY_SEPARATOR));
+
+        delegate->addressStealNeeded(address, entry);
+    }
+}
+
+
+
+
+template<class Features>
+bool
+BasicWiThrottleProtocol<Features>::checkHeartbeat()
+{
+    unsigned long now = clockMillis();
+    if (heartbeatPeriod > 0 && now - lastHeartbeatTime >= 500UL * heartbeatPeriod) {
+        lastHeartbeatTime = now;
+
+        sendCommand("*");
+        return true;
+    }
+    else {
+        return false;
+    }
+}
+
+
+template<class Features>
+void
+BasicWiThrottleProtocol<Features>::requireHeartbeat(bool needed)
+{
+    if (needed) {
+        sendCommand("*+");
+    }
+    else {
+        sendCommand("*-");
+    }
+}
+
+
+template<class Features>
+void
+BasicWiThrottleProtocol<Features>::resetMessages(WiThrottleFlag<true>)
+{
+    this->oldestMessage = 0;
+    this->messageCount = 0;
+    this->messagesEvicted = 0;
+}
+
+
+template<class Features>
+void
+BasicWiThrottleProtocol<Features>::processServerMessage(WiThrottleFlag<true>, char *c, int len)
+{
+    // [M|m|T|t]text
+
+    // a message the delegate has dealt with isn't kept, so a sketch that
+    // only uses the delegate never fills the slots
+    if (delegate && delegate->receivedServerMessage((ServerMessageType) c[0], c + 1)) {
+        return;
+    }
+
+    if (this->messageCount == Features::messageSlots) {
+        // full, so the oldest message makes way
+        this->oldestMessage = (this->oldestMessage + 1) % Features::messageSlots;
+        this->messageCount--;
+        this->messagesEvicted++;
+    }
+
+    MessageSlot& slot = this->messageSlots[(this->oldestMessage + this->messageCount) % Features::messageSlots];
+    this->messageCount++;
+
+    int textLength = min(len - 1, Features::messageSize - 1);
+    slot.type = c[0];
+    memcpy(slot.text, c + 1, textLength);
+    slot.text[textLength] = 0;
+}
+
+
+template<class Features>
+bool
+BasicWiThrottleProtocol<Features>::nextServerMessage(ServerMessageType *type, const char **text)
+{
+    static_assert(Features::messages, "nextServerMessage() needs Features::messages");
+    if (this->messageCount == 0) {
+        return false;
+    }
+
+    // the slot is only reused once a new message arrives, which can't
+    // happen until the next check()
+    MessageSlot& slot = this->messageSlots[this->oldestMessage];
+    this->oldestMessage = (this->oldestMessage + 1) % Features::messageSlots;
+    this->messageCount--;
+
+    *type = (ServerMessageType) slot.type;
+    *text = slot.text;
+    return true;
+}
+
+
+template<class Features>
+int
+BasicWiThrottleProtocol<Features>::serverMessagesWaiting()
+{
+    static_assert(Features::messages, "serverMessagesWaiting() needs Features::messages");
+    return this->messageCount;
+}
+
+
+template<class Features>
+unsigned long
+BasicWiThrottleProtocol<Features>::serverMessagesEvicted()
+{
+    static_assert(Features::messages, "serverMessagesEvicted() needs Features::messages");
+    return this->messagesEvicted;
+}
+
+
+template<class Features>
+bool
+BasicWiThrottleProtocol<Features>::setTurnout(String systemName, TurnoutAction action)
+{
+    static_assert(Features::turnouts, "setTurnout() needs Features::turnouts");
+    // PTA[C|T|2]name
+    char prefix[] = { 'P', 'T', 'A', (char) action, 0 };
+
+    uint8_t expected = 0;
+    if (action == TurnoutClose) {
+        expected = TurnoutClosed;
+    }
+    else if (action == TurnoutThrow) {
+        expected = TurnoutThrown;
+    }
+
+    return sendLayoutCommand(prefix, systemName, false, expected);
+}
+
+
+template<class Features>
+bool
+BasicWiThrottleProtocol<Features>::setRoute(String systemName)
+{
+    static_assert(Features::turnouts, "setRoute() needs Features::turnouts");
+    // PRA2name
+    return sendLayoutCommand("PRA2", systemName, true, RouteActive);
+}
+
+
+template<class Features>
+void
+BasicWiThrottleProtocol<Features>::setLayoutCommandTimeout(unsigned long timeout)
+{
+    static_assert(Features::turnouts, "setLayoutCommandTimeout() needs Features::turnouts");
+    this->layoutCommandTimeout = timeout;
+}
+
+
+template<class Features>
+int
+BasicWiThrottleProtocol<Features>::pendingLayoutCommands()
+{
+    static_assert(Features::turnouts, "pendingLayoutCommands() needs Features::turnouts");
+    int count = 0;
+    for (int i = 0; i < Features::maxPendingCommands; i++) {
+        if (this->pendingCommands[i].inUse) {
+            count++;
+        }
+    }
+    return count;
+}
+
+
+template<class Features>
+bool
+BasicWiThrottleProtocol<Features>::sendLayoutCommand(const char *prefix, const String& systemName,
+                                      bool route, uint8_t expectedState)
+{
+    if (!stream || systemName.length() == 0 ||
+        systemName.length() >= Features::systemNameSize) {
+        return false;
+    }
+
+    // a second command for the same turnout replaces the first, otherwise
+    // take a free slot
+    PendingCommand *slot = NULL;
+    for (int i = 0; i < Features::maxPendingCommands; i++) {
+        PendingCommand& pending = this->pendingCommands[i];
+        if (pending.inUse && pending.route == route &&
+            strcmp(pending.systemName, systemName.c_str()) == 0) {
+            slot = &pending;
+            break;
+        }
+        if (!pending.inUse && slot == NULL) {
+            slot = &pending;
+        }
+    }
+    if (slot == NULL) {
+        console->printf("too many layout commands pending, %s not sent\n", systemName.c_str());
+        return false;
+    }
+
+    strcpy(slot->systemName, systemName.c_str());
+    slot->inUse = true;
+    slot->route = route;
+    slot->expectedState = expectedState;
+    slot->sentTime = clockMillis();
+
+    String cmd = prefix;
+    cmd += systemName;
+    sendCommand(cmd);
+
+    return true;
+}
+
+
+// the states that PTA and PRA report (the TurnoutState and RouteState values)
+template<class Features>
+bool
+BasicWiThrottleProtocol<Features>::isLayoutState(char c)
+{
+    return c == '1' || c == '2' || c == '4' || c == '8';
+}
+
+
+template<class Features>
+void
+BasicWiThrottleProtocol<Features>::processTurnoutState(WiThrottleFlag<true>, char *c, int len)
+{
+    // [1|2|4|8]name
+    if (!isLayoutState(c[0])) {
+        console->printf("unknown turnout state '%c'\n", c[0]);
+        return;
+    }
+    uint8_t state = c[0] - '0';
+    const char *systemName = c + 1;
+
+    confirmLayoutCommand(systemName, false, state);
+
+    if (delegate) {
+        delegate->receivedTurnoutState(String(systemName), (TurnoutState) state);
+    }
+}
+
+
+template<class Features>
+void
+BasicWiThrottleProtocol<Features>::processRouteState(WiThrottleFlag<true>, char *c, int len)
+{
+    // [1|2|4|8]name
+    if (!isLayoutState(c[0])) {
+        console->printf("unknown route state '%c'\n", c[0]);
+        return;
+    }
+    uint8_t state = c[0] - '0';
+    const char *systemName = c + 1;
+
+    confirmLayoutCommand(systemName, true, state);
+
+    if (delegate) {
+        delegate->receivedRouteState(String(systemName), (RouteState) state);
+    }
+}
+
+
+template<class Features>
+void
+BasicWiThrottleProtocol<Features>::confirmLayoutCommand(const char *systemName, bool route, uint8_t state)
+{
+    for (int i = 0; i < Features::maxPendingCommands; i++) {
+        PendingCommand& pending = this->pendingCommands[i];
+        if (pending.inUse && pending.route == route &&
+            (pending.expectedState == 0 || pending.expectedState == state) &&
+            strcmp(pending.systemName, systemName) == 0) {
+            finishLayoutCommand(pending, true, clockMillis());
+            return;
+        }
+    }
+}
+
+
+template<class Features>
+void
+BasicWiThrottleProtocol<Features>::finishLayoutCommand(PendingCommand& pending, bool confirmed, unsigned long now)
+{
+    pending.inUse = false;
+    unsigned long latency = now - pending.sentTime;
+
+    if (!confirmed) {
+        console->printf("no confirmation for %s after %lu ms\n", pending.systemName, latency);
+    }
+
+    if (delegate) {
+        if (pending.route) {
+            delegate->routeCommandFinished(String(pending.systemName), confirmed, latency);
+        }
+        else {
+            delegate->turnoutCommandFinished(String(pending.systemName), confirmed, latency);
+        }
+    }
+}
+
+
+template<class Features>
+void
+BasicWiThrottleProtocol<Features>::resetLayoutCommands(WiThrottleFlag<true>)
+{
+    // commands from an earlier connection will never be confirmed now
+    for (int i = 0; i < Features::maxPendingCommands; i++) {
+        if (this->pendingCommands[i].inUse) {
+            finishLayoutCommand(this->pendingCommands[i], false, clockMillis());
+        }
+    }
+    memset(this->pendingCommands, 0, sizeof(this->pendingCommands));
+}
+
+
+template<class Features>
+bool
+BasicWiThrottleProtocol<Features>::checkLayoutCommands(WiThrottleFlag<true>)
+{
+    bool changed = false;
+    unsigned long now = clockMillis();
+
+    for (int i = 0; i < Features::maxPendingCommands; i++) {
+        PendingCommand& pending = this->pendingCommands[i];
+        if (pending.inUse && now - pending.sentTime >= this->layoutCommandTimeout) {
+            finishLayoutCommand(pending, false, now);
+            changed = true;
+        }
+    }
+
+    return changed;
+}
+
+
+template<class Features>
+void
+BasicWiThrottleProtocol<Features>::resetThrottle(WiThrottleFlag<true>)
+{
+    this->locomotiveSelected = false;
+    this->speedSent = false;
+    this->consistCount = 0;
+    this->consistChanged = false;
+    this->consistSettling = false;
+}
+
+
+template<class Features>
+void
+BasicWiThrottleProtocol<Features>::selectOnConnect(WiThrottleFlag<true>, const String& address, String& handshake)
+{
+    if (address.length() > 0 && (address[0] == 'S' || address[0] == 'L')) {
+        handshake += "MT+" + address + PROPERTY_SEPARATOR + address + "\r\n";
+        addConsistMember(address);
+        this->currentAddress = address;
+        this->locomotiveSelected = true;
+        readyWhen |= GreetingLocomotive;
+    }
+}
+
+
+template<class Features>
+bool
+BasicWiThrottleProtocol<Features>::addLocomotive(String address)
+{
+    static_assert(Features::throttle, "addLocomotive() needs Features::throttle");
+    bool ok = false;
+
+    if ((address[0] == 'S' || address[0] == 'L') && addConsistMember(address)) {
+        String rosterName = address;  // for now -- could look this up...
+        String cmd = "MT+" + address + PROPERTY_SEPARATOR + rosterName;
+        sendCommand(cmd);
+
+        // the first locomotive added leads the consist
+        if (!this->locomotiveSelected) {
+            this->currentAddress = address;
+        }
+        ok = true;
+
+        this->locomotiveSelected = true;
+    }
+
+    return ok;
+}
+
+
+template<class Features>
+bool
+BasicWiThrottleProtocol<Features>::stealLocomotive(String address)
+{
+    static_assert(Features::throttle, "stealLocomotive() needs Features::throttle");
+    bool ok = false;
+
+    if (releaseLocomotive(address)) {
+        ok = addLocomotive(address);
+    }
+
+    return ok;
+}
+
+
+template<class Features>
+bool
+BasicWiThrottleProtocol<Features>::releaseLocomotive(String address)
+{
+    static_assert(Features::throttle, "releaseLocomotive() needs Features::throttle");
+    // MT-*<;>r
+    String cmd = "MT-";
+    cmd.concat(address);
+    cmd.concat(PROPERTY_SEPARATOR);
+    cmd.concat("r");
+    sendCommand(cmd);
+
+    removeConsistMember(address.c_str(), address.length());
+
+    return true;
+}
+
+
+template<class Features>
+bool
+BasicWiThrottleProtocol<Features>::addConsistMember(const String& address)
+{
+    if (findConsistMember(address.c_str(), address.length()) >= 0) {
+        return true;
+    }
+    if (this->consistCount == Features::maxConsist ||
+        address.length() >= sizeof(this->consist[0].address)) {
+        return false;
+    }
+
+    ConsistMember& member = this->consist[this->consistCount++];
+    strcpy(member.address, address.c_str());
+    member.inverted = false;
+    member.speed = -1;
+    member.direction = Forward;
+    member.echoed = true;
+    member.speedCurve = NULL;
+    member.speedCurvePoints = 0;
+    return true;
+}
+
+
+// Both our own releases and the server's MT- come through here, so the
+// lead and the selection always follow what is left of the consist.
+template<class Features>
+void
+BasicWiThrottleProtocol<Features>::removeConsistMember(const char *address, int length)
+{
+    int member;
+    if (length == 1 && address[0] == '*') {
+        member = 0;
+        this->consistCount = 0;
+    }
+    else {
+        member = findConsistMember(address, length);
+        if (member < 0) {
+            return;
+        }
+
+        // keep the members in the order they were added, so the lead stays first
+        for (int i = member; i < this->consistCount - 1; i++) {
+            this->consist[i] = this->consist[i + 1];
+        }
+        this->consistCount--;
+    }
+
+    if (this->consistCount == 0) {
+        // nothing left to drive, so nothing more is sent or reported
+        this->locomotiveSelected = false;
+        this->currentAddress = "";
+        this->rampActive = false;
+    }
+    else if (member == 0) {
+        // the next member takes the lead
+        this->currentAddress = this->consist[0].address;
+    }
+}
+
+
+template<class Features>
+int
+BasicWiThrottleProtocol<Features>::findConsistMember(const char *address, int length)
+{
+    for (int i = 0; i < this->consistCount; i++) {
+        if ((int) strlen(this->consist[i].address) == length &&
+            strncmp(this->consist[i].address, address, length) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+
+template<class Features>
+void
+BasicWiThrottleProtocol<Features>::processMemberAction(int member, char *c, int len)
+{
+    ConsistMember& m = this->consist[member];
+
+    if (c[0] == 'V' && len >= 2) {
+        int speed = atoi(c+1);
+        if (speed < MIN_SPEED || speed > MAX_SPEED) {
+            speed = 0;
+        }
+        m.echoed = true;
+        if (speed != m.speed) {
+            m.speed = speed;
+            this->consistChanged = true;
+        }
+    }
+    else if (c[0] == 'R' && len == 2) {
+        // an inverted member running in reverse moves the consist forward
+        bool forward = (c[1] != '0');
+        if (m.inverted) {
+            forward = !forward;
+        }
+        Direction direction = forward ? Forward : Reverse;
+        m.echoed = true;
+        if (direction != m.direction) {
+            m.direction = direction;
+            this->consistChanged = true;
+        }
+    }
+}
+
+
+template<class Features>
+void
+BasicWiThrottleProtocol<Features>::reportConsistState()
+{
+    if (!delegate || this->consistCount == 0) {
+        return;
+    }
+
+    const ConsistMember& lead = this->consist[0];
+    bool inStep = true;
+    for (int i = 1; i < this->consistCount; i++) {
+        if (this->consist[i].speed != lead.speed || this->consist[i].direction != lead.direction) {
+            inStep = false;
+        }
+    }
+
+    delegate->receivedConsistState(max(lead.speed, 0), lead.direction, inStep && lead.speed >= 0);
+}
+
+
+// A command to the whole consist is echoed by each member in turn, and
+// not necessarily all in the same check(), so the report waits until
+// they all have (or until the settle timeout, for a member that doesn't).
+template<class Features>
+void
+BasicWiThrottleProtocol<Features>::startConsistSettle()
+{
+    for (int i = 0; i < this->consistCount; i++) {
+        this->consist[i].echoed = false;
+    }
+    this->consistSettling = (this->consistCount > 0);
+    this->consistCommandTime = clockMillis();
+}
+
+
+// echoes from each member of a consist are merged into one report
+template<class Features>
+bool
+BasicWiThrottleProtocol<Features>::checkConsist(WiThrottleFlag<true>)
+{
+    if (!this->consistChanged) {
+        return false;
+    }
+
+    if (this->consistSettling) {
+        bool allEchoed = true;
+        for (int i = 0; i < this->consistCount; i++) {
+            allEchoed &= this->consist[i].echoed;
+        }
+        if (!allEchoed && clockMillis() - this->consistCommandTime < this->consistSettleTimeout) {
+            return false;
+        }
+        this->consistSettling = false;
+    }
+
+    this->consistChanged = false;
+    reportConsistState();
+    return true;
+}
+
+
+template<class Features>
+bool
+BasicWiThrottleProtocol<Features>::setConsistMemberInverted(String address, bool inverted)
+{
+    static_assert(Features::throttle, "setConsistMemberInverted() needs Features::throttle");
+    int member = findConsistMember(address.c_str(), address.length());
+    if (member < 0) {
+        return false;
+    }
+    this->consist[member].inverted = inverted;
+    return true;
+}
+
+
+template<class Features>
+void
+BasicWiThrottleProtocol<Features>::setConsistSettleTimeout(unsigned long timeout)
+{
+    static_assert(Features::throttle, "setConsistSettleTimeout() needs Features::throttle");
+    this->consistSettleTimeout = timeout;
+}
+
+
+template<class Features>
+int
+BasicWiThrottleProtocol<Features>::consistSize()
+{
+    static_assert(Features::throttle, "consistSize() needs Features::throttle");
+    return this->consistCount;
+}
+
+
+template<class Features>
+const char *
+BasicWiThrottleProtocol<Features>::consistMemberAddress(int member)
+{
+    static_assert(Features::throttle, "consistMemberAddress() needs Features::throttle");
+    if (member < 0 || member >= this->consistCount) {
+        return NULL;
+    }
+    return this->consist[member].address;
+}
+
+
+template<class Features>
+bool
+BasicWiThrottleProtocol<Features>::consistMemberInverted(int member)
+{
+    static_assert(Features::throttle, "consistMemberInverted() needs Features::throttle");
+    if (member < 0 || member >= this->consistCount) {
+        return false;
+    }
+    return this->consist[member].inverted;
+}
+
+
+template<class Features>
+int
+BasicWiThrottleProtocol<Features>::consistMemberSpeed(int member)
+{
+    static_assert(Features::throttle, "consistMemberSpeed() needs Features::throttle");
+    if (member < 0 || member >= this->consistCount) {
+        return -1;
+    }
+    return this->consist[member].speed;
+}
+
+
+template<class Features>
+bool
+BasicWiThrottleProtocol<Features>::setSpeed(int speed)
+{
+    static_assert(Features::throttle, "setSpeed() needs Features::throttle");
+    if (speed < 0 || speed > 126) {
+        return false;
+    }
+    if (!this->locomotiveSelected) {
+        return false;
+    }
+
+    // a direct speed setting overrides any ramp in progress
+    this->rampActive = false;
+    this->targetSpeed = speed;
+
+    sendSpeed(speed);
+    return true;
+}
+
+
+template<class Features>
+void
+BasicWiThrottleProtocol<Features>::sendSpeed(int speed)
+{
+    if (speed != this->currentSpeed) {
+        char cmd[16];
+        snprintf(cmd, sizeof(cmd), "MTA*" PROPERTY_SEPARATOR "V%d", speed);
+        sendCommand(cmd);
+        startConsistSettle();
+        this->currentSpeed = speed;
+        this->lastSpeedTime = clockMillis();
+        this->speedSent = true;
+    }
+}
+
+
+template<class Features>
+bool
+BasicWiThrottleProtocol<Features>::setTargetSpeed(int throttle)
+{
+    static_assert(Features::throttle, "setTargetSpeed() needs Features::throttle");
+    if (throttle < 0 || throttle > 126) {
+        return false;
+    }
+    if (!this->locomotiveSelected) {
+        return false;
+    }
+
+    this->targetSpeed = applySpeedCurve(throttle);
+
+    if (this->targetSpeed == this->currentSpeed) {
+        this->rampActive = false;
+    }
+    else if (!this->rampActive) {
+        this->rampActive = true;
+        this->lastRampTime = clockMillis();
+    }
+    return true;
+}
+
+
+template<class Features>
+int
+BasicWiThrottleProtocol<Features>::getTargetSpeed()
+{
+    static_assert(Features::throttle, "getTargetSpeed() needs Features::throttle");
+    return this->targetSpeed;
+}
+
+
+template<class Features>
+void
+BasicWiThrottleProtocol<Features>::setMomentum(unsigned int acceleration, unsigned int deceleration)
+{
+    static_assert(Features::throttle, "setMomentum() needs Features::throttle");
+    this->accelerationDelay = acceleration;
+    this->decelerationDelay = deceleration;
+}
+
+
+template<class Features>
+void
+BasicWiThrottleProtocol<Features>::setMaxSpeedRate(unsigned int interval)
+{
+    static_assert(Features::throttle, "setMaxSpeedRate() needs Features::throttle");
+    this->speedInterval = interval;
+}
+
+
+template<class Features>
+bool
+BasicWiThrottleProtocol<Features>::setSpeedCurve(const uint8_t *curve, uint8_t points)
+{
+    static_assert(Features::throttle, "setSpeedCurve() needs Features::throttle");
+    if (!this->locomotiveSelected) {
+        return false;
+    }
+    return setSpeedCurve(this->currentAddress, curve, points);
+}
+
+
+template<class Features>
+bool
+BasicWiThrottleProtocol<Features>::setSpeedCurve(String address, const uint8_t *curve, uint8_t points)
+{
+    static_assert(Features::throttle, "setSpeedCurve() needs Features::throttle");
+    int member = findConsistMember(address.c_str(), address.length());
+    if (member < 0) {
+        return false;
+    }
+
+    ConsistMember& m = this->consist[member];
+    if (curve == NULL || points < 2) {
+        m.speedCurve = NULL;
+        m.speedCurvePoints = 0;
+    }
+    else {
+        m.speedCurve = curve;
+        m.speedCurvePoints = points;
+    }
+    return true;
+}
+
+
+template<class Features>
+int
+BasicWiThrottleProtocol<Features>::applySpeedCurve(int throttle)
+{
+    // one speed is sent for the whole consist, so the lead's curve is used
+    if (this->consistCount == 0 || this->consist[0].speedCurve == NULL) {
+        return throttle;
+    }
+    const uint8_t *speedCurve = this->consist[0].speedCurve;
+    uint8_t speedCurvePoints = this->consist[0].speedCurvePoints;
+
+    // the curve points are spread evenly over the throttle range, and
+    // throttle settings between two points are interpolated
+    int segments = speedCurvePoints - 1;
+    int scaled = throttle * segments;
+    int segment = scaled / MAX_SPEED;
+    if (segment >= segments) {
+        return min((int) speedCurve[segments], MAX_SPEED);
+    }
+
+    int low = speedCurve[segment];
+    int high = speedCurve[segment + 1];
+    int fraction = scaled - segment * MAX_SPEED;
+    int speed = low + ((high - low) * fraction + MAX_SPEED / 2) / MAX_SPEED;
+
+    return constrain(speed, MIN_SPEED, MAX_SPEED);
+}
+
+
+template<class Features>
+const uint8_t *
+BasicWiThrottleProtocol<Features>::speedTable(int *notches)
+{
+    switch (this->speedSteps) {
+        case 2:
+        case 16:
+            *notches = sizeof(WiThrottleSpeedTables::steps28) - 1;
+            return WiThrottleSpeedTables::steps28;
+        case 4:
+            *notches = sizeof(WiThrottleSpeedTables::steps27) - 1;
+            return WiThrottleSpeedTables::steps27;
+        case 8:
+            *notches = sizeof(WiThrottleSpeedTables::steps14) - 1;
+            return WiThrottleSpeedTables::steps14;
+        default:
+            // 128 steps (or not known yet), every V value is a notch
+            *notches = MAX_SPEED;
+            return NULL;
+    }
+}
+
+
+template<class Features>
+bool
+BasicWiThrottleProtocol<Features>::checkMomentum(WiThrottleFlag<true>)
+{
+    if (!this->rampActive || !this->locomotiveSelected) {
+        return false;
+    }
+
+    // the rate limit counts from the last speed sent, so the first step
+    // of the first ramp goes out as soon as it is due
+    unsigned long now = clockMillis();
+    if (this->speedSent && now - this->lastSpeedTime < this->speedInterval) {
+        return false;
+    }
+    unsigned long elapsed = now - this->lastRampTime;
+
+    int notches;
+    const uint8_t *table = speedTable(&notches);
+
+    int current = (this->currentSpeed * notches + MAX_SPEED / 2) / MAX_SPEED;
+    int target = (this->targetSpeed * notches + MAX_SPEED / 2) / MAX_SPEED;
+
+    // compare speeds rather than notches, as the speed might sit between
+    // two notches
+    bool accelerating = this->targetSpeed > this->currentSpeed;
+    unsigned int notchDelay = accelerating ? this->accelerationDelay : this->decelerationDelay;
+
+    int advance = notchDelay ? min(elapsed / notchDelay, (unsigned long) notches) : notches;
+    if (advance == 0) {
+        return false;
+    }
+
+    int next;
+    if (accelerating) {
+        next = min(current + advance, target);
+    }
+    else {
+        next = max(current - advance, target);
+    }
+
+    int speed;
+    if (next == target) {
+        speed = this->targetSpeed;
+        this->rampActive = false;
+    }
+    else {
+        speed = table ? table[next] : next;
+    }
+
+    // carry over the part of a notch that has already elapsed, so the
+    // ramp takes as long as it should whatever the message rate is
+    this->lastRampTime = notchDelay ? this->lastRampTime + (unsigned long) advance * notchDelay : now;
+
+    sendSpeed(speed);
+    return true;
+}
+
+
+template<class Features>
+int
+BasicWiThrottleProtocol<Features>::getSpeed()
+{
+    static_assert(Features::throttle, "getSpeed() needs Features::throttle");
+    return this->currentSpeed;
+}
+
+
+template<class Features>
+bool
+BasicWiThrottleProtocol<Features>::setDirection(Direction direction)
+{
+    static_assert(Features::throttle, "setDirection() needs Features::throttle");
+    if (!this->locomotiveSelected) {
+        return false;
+    }
+
+
+    bool anyInverted = false;
+    for (int i = 0; i < this->consistCount; i++) {
+        anyInverted |= this->consist[i].inverted;
+    }
+
+    if (!anyInverted) {
+        if (direction == Reverse) {
+            sendCommand("MTA*" PROPERTY_SEPARATOR "R0");
+        }
+        else {
+            sendCommand("MTA*" PROPERTY_SEPARATOR "R1");
+        }
+    }
+    else {
+        // the members can't all be sent the same direction, so each gets
+        // its own command, but they still go to the server in one write
+        const char *ending = this->isServer() ? "\r\n\r\n" : "\r\n";
+        char cmds[Features::maxConsist * 24];
+        size_t length = 0;
+        for (int i = 0; i < this->consistCount; i++) {
+            bool forward = (direction == Forward) != this->consist[i].inverted;
+            length += snprintf(cmds + length, sizeof(cmds) - length,
+                               "MTA%s" PROPERTY_SEPARATOR "R%c%s",
+                               this->consist[i].address, forward ? '1' : '0', ending);
+        }
+        sendCommands(cmds, length);
+    }
+    startConsistSettle();
+
+    this->currentDirection = direction;
+    return true;
+}
+
+
+template<class Features>
+Direction
+BasicWiThrottleProtocol<Features>::getDirection()
+{
+    static_assert(Features::throttle, "getDirection() needs Features::throttle");
+    return this->currentDirection;
+}
+
+
+template<class Features>
+void
+BasicWiThrottleProtocol<Features>::emergencyStop()
+{
+    static_assert(Features::throttle, "emergencyStop() needs Features::throttle");
+    this->rampActive = false;
+    this->targetSpeed = 0;
+    this->currentSpeed = 0;
+
+    sendCommand("MTA*" PROPERTY_SEPARATOR "X");
+    startConsistSettle();
+}
+
+
+template<class Features>
+void
+BasicWiThrottleProtocol<Features>::setFunction(int funcNum, bool pressed)
+{
+    static_assert(Features::throttle, "setFunction() needs Features::throttle");
+    if (!this->locomotiveSelected) {
+        return;
+    }
+
+    if (funcNum < 0 || funcNum > 28) {
+        return;
+    }
+
+    char cmd[32];
+    int cmdLength = snprintf(cmd, sizeof(cmd), "MTA%s" PROPERTY_SEPARATOR "F%c%d",
+                             this->currentAddress.c_str(), pressed ? '1' : '0', funcNum);
+    if (cmdLength < 0 || cmdLength >= (int) sizeof(cmd)) {
+        // an address this long was never going to be accepted by the server
+        return;
+    }
+
+    sendCommand(cmd);
+}
+
+
+
+
+
+#undef NEWLINE
+#undef CR
+#undef PROPERTY_SEPARATOR
+
+#endif // WITHROTTLE_IMPL_H
@@ -0,0 +1,317 @@
+/* -*- c++ -*-
+ *
+ * WiThrottleRecorder
+ *
+ * Stream decorators used to capture a WiThrottle protocol session and to
+ * play it back later through a WiThrottleProtocol object, so that traffic
+ * seen in the field can be reproduced on the bench.
+ *
+ * Copyright © 2018-2019, 2021 Blue Knobby Systems Inc.
+ *
+ * This work is licensed under the Creative Commons Attribution-ShareAlike
+ * 4.0 International License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-sa/4.0/ or send a letter to
+ * Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+ *
+ * Attribution — You must give appropriate credit, provide a link to the
+ * license, and indicate if changes were made. You may do so in any
+ * reasonable manner, but not in any way that suggests the licensor
+ * endorses you or your use.
+ *
+ * ShareAlike — If you remix, transform, or build upon the material, you
+ * must distribute your contributions under the same license as the
+ * original.
+ *
+ * All other rights reserved.
+ *
+ */
+
+#include "WiThrottleRecorder.h"
+
+
+#define DIRECTION_BIT 0x80
+#define LENGTH_MASK   0x7f
+
+
+WiThrottleRecorder::WiThrottleRecorder(Stream *network, Print *log):
+    network(network),
+    log(log),
+    chunkLength(0),
+    chunkDirection(RecordInbound),
+    chunkTime(0),
+    lastRecordTime(millis())
+{
+}
+
+
+void
+WiThrottleRecorder::sync()
+{
+    if (chunkLength == 0) {
+        return;
+    }
+
+    uint8_t header = chunkLength;
+    if (chunkDirection == RecordOutbound) {
+        header |= DIRECTION_BIT;
+    }
+    log->write(header);
+
+    unsigned long delta = chunkTime - lastRecordTime;
+    do {
+        uint8_t group = delta & 0x7f;
+        delta >>= 7;
+        if (delta) {
+            group |= 0x80;
+        }
+        log->write(group);
+    } while (delta);
+
+    log->write(chunk, chunkLength);
+
+    lastRecordTime = chunkTime;
+    chunkLength = 0;
+}
+
+
+void
+WiThrottleRecorder::record(RecordDirection direction, uint8_t b)
+{
+    unsigned long now = millis();
+
+    // a record holds bytes that went the same way within the same millisecond
+    if (chunkLength > 0 &&
+        (direction != chunkDirection || now != chunkTime || chunkLength == MAX_CHUNK)) {
+        sync();
+    }
+
+    if (chunkLength == 0) {
+        chunkDirection = direction;
+        chunkTime = now;
+    }
+    chunk[chunkLength++] = b;
+}
+
+
+int
+WiThrottleRecorder::available()
+{
+    return network->available();
+}
+
+
+int
+WiThrottleRecorder::read()
+{
+    int b = network->read();
+    if (b >= 0) {
+        record(RecordInbound, (uint8_t) b);
+    }
+    return b;
+}
+
+
+int
+WiThrottleRecorder::peek()
+{
+    return network->peek();
+}
+
+
+void
+WiThrottleRecorder::flush()
+{
+    network->flush();
+    sync();
+}
+
+
+size_t
+WiThrottleRecorder::write(uint8_t b)
+{
+    size_t written = network->write(b);
+    if (written == 1) {
+        record(RecordOutbound, b);
+    }
+    return written;
+}
+
+
+size_t
+WiThrottleRecorder::write(const uint8_t *buffer, size_t size)
+{
+    size_t written = network->write(buffer, size);
+    for (size_t i = 0; i < written; i++) {
+        record(RecordOutbound, buffer[i]);
+    }
+    return written;
+}
+
+
+
+WiThrottleReplay::WiThrottleReplay(Stream *recording):
+    recording(recording),
+    realTime(false),
+    started(false),
+    exhausted(false),
+    recordDone(true),  // the start is treated as the end of a record
+    startTime(0),
+    virtualTime(0),
+    direction(RecordInbound),
+    recordTime(0),
+    remaining(0)
+{
+}
+
+
+void
+WiThrottleReplay::setRealTime(bool realTime)
+{
+    this->realTime = realTime;
+}
+
+
+unsigned long
+WiThrottleReplay::now()
+{
+    if (realTime && started) {
+        return millis() - startTime;
+    }
+    return virtualTime;
+}
+
+
+bool
+WiThrottleReplay::finished()
+{
+    return exhausted && remaining == 0;
+}
+
+
+bool
+WiThrottleReplay::readVarint(unsigned long *value)
+{
+    unsigned long result = 0;
+    uint8_t shift = 0;
+
+    while (shift < 8 * sizeof(result)) {
+        int b = recording->read();
+        if (b < 0) {
+            return false;
+        }
+        result |= (unsigned long) (b & 0x7f) << shift;
+        if ((b & 0x80) == 0) {
+            *value = result;
+            return true;
+        }
+        shift += 7;
+    }
+
+    // too many continuation bytes, the recording is corrupt
+    return false;
+}
+
+
+bool
+WiThrottleReplay::loadRecord()
+{
+    while (remaining == 0) {
+        if (exhausted) {
+            return false;
+        }
+
+        int header = recording->read();
+        unsigned long delta;
+        if (header < 0 || !readVarint(&delta) || (header & LENGTH_MASK) == 0) {
+            exhausted = true;
+            return false;
+        }
+
+        if (!started) {
+            startTime = millis();
+            started = true;
+        }
+
+        direction = (header & DIRECTION_BIT) ? RecordOutbound : RecordInbound;
+        recordTime += delta;
+        remaining = header & LENGTH_MASK;
+
+        if (direction == RecordOutbound) {
+            // what we sent in the original session is of no interest to
+            // the protocol object, so skip over it
+            while (remaining > 0 && recording->read() >= 0) {
+                remaining--;
+            }
+            if (remaining > 0) {
+                remaining = 0;
+                exhausted = true;
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+
+int
+WiThrottleReplay::available()
+{
+    bool between = recordDone;
+    recordDone = false;
+
+    if (!loadRecord()) {
+        return 0;
+    }
+
+    if (realTime) {
+        if (now() < recordTime) {
+            return 0;
+        }
+    }
+    else if (virtualTime < recordTime) {
+        virtualTime = recordTime;
+    }
+
+    // Report nothing once between records, which ends the read loop in
+    // check().  The clock has already moved to the next record, so the
+    // next check() runs the protocol's timers at that time before it
+    // reads the record, just as it would have in the original session.
+    return between ? 0 : remaining;
+}
+
+
+int
+WiThrottleReplay::read()
+{
+    if (available() == 0) {
+        return -1;
+    }
+
+    int b = recording->read();
+    if (b < 0) {
+        remaining = 0;
+        exhausted = true;
+        return -1;
+    }
+    remaining--;
+    recordDone = (remaining == 0);
+    return b;
+}
+
+
+int
+WiThrottleReplay::peek()
+{
+    if (available() == 0) {
+        return -1;
+    }
+    return recording->peek();
+}
+
+
+size_t
+WiThrottleReplay::write(uint8_t b)
+{
+    return 1;
+}
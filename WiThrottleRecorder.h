@@ -0,0 +1,133 @@
+/* -*- c++ -*-
+ *
+ * WiThrottleRecorder
+ *
+ * Stream decorators used to capture a WiThrottle protocol session and to
+ * play it back later through a WiThrottleProtocol object, so that traffic
+ * seen in the field can be reproduced on the bench.
+ *
+ * Copyright © 2018-2019, 2021 Blue Knobby Systems Inc.
+ *
+ * This work is licensed under the Creative Commons Attribution-ShareAlike
+ * 4.0 International License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-sa/4.0/ or send a letter to
+ * Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+ *
+ * Attribution — You must give appropriate credit, provide a link to the
+ * license, and indicate if changes were made. You may do so in any
+ * reasonable manner, but not in any way that suggests the licensor
+ * endorses you or your use.
+ *
+ * ShareAlike — If you remix, transform, or build upon the material, you
+ * must distribute your contributions under the same license as the
+ * original.
+ *
+ * All other rights reserved.
+ *
+ */
+
+#ifndef WITHROTTLE_RECORDER_H
+#define WITHROTTLE_RECORDER_H
+
+#include "Arduino.h"
+
+#include "WiThrottleProtocol.h"
+
+// Recording format
+//
+// A recording is a sequence of records.  Each record is
+//
+//   header   1 byte   bit 7 is the direction (0 = from the server,
+//                     1 = to the server), bits 0-6 are the payload
+//                     length (1-127)
+//   delta    varint   milliseconds since the previous record, 7 bits
+//                     per byte, least significant group first, high bit
+//                     set on all but the last byte
+//   payload  n bytes  the bytes exactly as they crossed the connection
+
+typedef enum RecordDirection {
+    RecordInbound = 0,
+    RecordOutbound = 1
+} RecordDirection;
+
+
+class WiThrottleRecorder : public Stream
+{
+  public:
+    WiThrottleRecorder(Stream *network, Print *log);
+
+    // write out any bytes that are still being collected into a record
+    void sync();
+
+    virtual int available();
+    virtual int read();
+    virtual int peek();
+    virtual void flush();
+    virtual size_t write(uint8_t b);
+    virtual size_t write(const uint8_t *buffer, size_t size);
+
+  private:
+    static const uint8_t MAX_CHUNK = 127;
+
+    void record(RecordDirection direction, uint8_t b);
+
+    Stream *network;
+    Print *log;
+
+    uint8_t chunk[MAX_CHUNK];
+    uint8_t chunkLength;
+    RecordDirection chunkDirection;
+    unsigned long chunkTime;
+    unsigned long lastRecordTime;
+};
+
+
+// Plays a recording back as the server side of a connection.  The replay
+// is also a clock: give it to WiThrottleProtocol::setClock() and every
+// timer in the protocol runs on the recording's time, so that a replay
+// at full speed behaves exactly as the original session did.
+class WiThrottleReplay : public Stream, public WiThrottleClock
+{
+  public:
+    WiThrottleReplay(Stream *recording);
+
+    // In real time mode, inbound bytes become available when as much
+    // time has passed as did in the original session.  Otherwise the
+    // virtual clock jumps straight to the next record.
+    void setRealTime(bool realTime);
+
+    // milliseconds since the start of the recording, as seen by the replay
+    virtual unsigned long now();
+
+    // true once every record in the recording has been consumed
+    bool finished();
+
+    // Bytes written by the protocol object are discarded, and the
+    // outbound records in the recording are skipped.
+
+    virtual int available();
+    virtual int read();
+    virtual int peek();
+    virtual size_t write(uint8_t b);
+
+  private:
+    bool loadRecord();
+    bool readVarint(unsigned long *value);
+
+    Stream *recording;
+    bool realTime;
+    bool started;
+    bool exhausted;
+    bool recordDone;  // between records: the last one has just been read to the end
+
+    unsigned long startTime;
+    unsigned long virtualTime;
+
+    // the record currently being handed out
+    RecordDirection direction;
+    unsigned long recordTime;
+    uint8_t remaining;
+};
+
+
+#endif // WITHROTTLE_RECORDER_H
@@ -0,0 +1,180 @@
+/*
+ * Microbenchmarks for the WiThrottleProtocol message handlers
+ *
+ * Each inbound benchmark hands one server line to check() per iteration,
+ * so that line's handler runs once.  Framing (reading the bytes and
+ * splitting lines) is included in every figure; the short PPA and *
+ * lines show roughly what that costs.  The outbound benchmarks call the
+ * command builders directly.
+ *
+ * Alongside the time, every benchmark reports allocs/op: the number of
+ * heap allocations per iteration.  The host String allocates the way the
+ * Arduino one does, so this is what each handler costs the heap on a
+ * real board.
+ *
+ *     bench_handlers --benchmark_format=json
+ *
+ * writes results in a form CI can store and compare between builds
+ * (for example with compare.py from Google Benchmark).
+ *
+ * Copyright © 2018-2019, 2021 Blue Knobby Systems Inc.
+ *
+ * This work is licensed under the Creative Commons Attribution-ShareAlike
+ * 4.0 International License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-sa/4.0/ or send a letter to
+ * Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+ *
+ * All other rights reserved.
+ *
+ */
+
+#include <new>
+
+#include <benchmark/benchmark.h>
+
+#include "WiThrottleProtocol.h"
+
+#include "HostStreams.h"
+
+
+static size_t allocations = 0;
+
+// These are kept out of line; inlined, GCC pairs malloc() with delete
+// and free() with new, and warns about both.
+__attribute__((noinline)) void *operator new(size_t size)
+{
+    allocations++;
+    void *p = malloc(size ? size : 1);
+    if (p == NULL) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+__attribute__((noinline)) void *operator new[](size_t size) { return operator new(size); }
+__attribute__((noinline)) void operator delete(void *p) noexcept { free(p); }
+__attribute__((noinline)) void operator delete[](void *p) noexcept { free(p); }
+__attribute__((noinline)) void operator delete(void *p, size_t) noexcept { free(p); }
+__attribute__((noinline)) void operator delete[](void *p, size_t) noexcept { free(p); }
+
+
+// Takes every argument by value, as a sketch's delegate would, so the
+// cost of building the Strings is counted.
+class BenchDelegate : public WiThrottleProtocolDelegate
+{
+  public:
+    void addressAdded(String address, String entry) { benchmark::DoNotOptimize(address.c_str()); }
+    void addressRemoved(String address, String command) { benchmark::DoNotOptimize(address.c_str()); }
+    void addressStealNeeded(String address, String entry) { benchmark::DoNotOptimize(address.c_str()); }
+    void receivedSpeed(int speed) { benchmark::DoNotOptimize(speed); }
+    void receivedFunctionState(uint8_t func, bool state) { benchmark::DoNotOptimize(func); }
+    void receivedTrackPower(TrackPower state) { benchmark::DoNotOptimize(state); }
+};
+
+
+class BenchClock : public WiThrottleClock
+{
+  public:
+    BenchClock() : time(0) { }
+    virtual unsigned long now() { return time; }
+    unsigned long time;
+};
+
+
+// A client connected with locomotive L3 selected.
+class Session
+{
+  public:
+    Session() {
+        protocol.delegate = &delegate;
+        protocol.setClock(&clock);
+        WiThrottleConnectOptions options;
+        options.locomotive = "L3";
+        protocol.connect(&network, options);
+    }
+
+    BenchClock clock;
+    MemoryStream network;
+    BenchDelegate delegate;
+    WiThrottleProtocol protocol;
+};
+
+
+static void
+reportAllocations(benchmark::State& state, size_t count)
+{
+    state.counters["allocs/op"] = benchmark::Counter(count, benchmark::Counter::kAvgIterations);
+}
+
+
+static void
+inbound(benchmark::State& state, const char *line)
+{
+    Session session;
+    size_t length = strlen(line);
+    size_t count = 0;
+
+    for (auto _ : state) {
+        session.network.load((const uint8_t *) line, length);
+        size_t before = allocations;
+        session.protocol.check();
+        count += allocations - before;
+    }
+
+    reportAllocations(state, count);
+    state.SetBytesProcessed(state.iterations() * length);
+}
+
+BENCHMARK_CAPTURE(inbound, processLocomotiveAction, "MTAL3<;>R1\n");
+BENCHMARK_CAPTURE(inbound, processSpeed, "MTAL3<;>V42\n");
+BENCHMARK_CAPTURE(inbound, processFunctionState, "MTAL3<;>F112\n");
+BENCHMARK_CAPTURE(inbound, processSpeedSteps, "MTAL3<;>s2\n");
+BENCHMARK_CAPTURE(inbound, processFastTime, "PFT1617000000<;>4.0\n");
+BENCHMARK_CAPTURE(inbound, processStealNeeded, "MTSL3<;>L3\n");
+BENCHMARK_CAPTURE(inbound, processTrackPower, "PPA1\n");
+BENCHMARK_CAPTURE(inbound, processHeartbeat, "*10\n");
+// a member is added and then removed, so each iteration runs the
+// handler twice
+BENCHMARK_CAPTURE(inbound, processAddRemove_pair, "MT+L5<;>Shay\nMT-L5<;>r\n");
+
+
+static void
+outbound_setSpeed(benchmark::State& state)
+{
+    Session session;
+    size_t count = 0;
+    int speed = 0;
+
+    for (auto _ : state) {
+        // alternate, since an unchanged speed is not sent
+        speed = 42 - speed;
+        size_t before = allocations;
+        session.protocol.setSpeed(speed);
+        count += allocations - before;
+    }
+
+    reportAllocations(state, count);
+}
+BENCHMARK(outbound_setSpeed);
+
+
+static void
+outbound_setFunction(benchmark::State& state)
+{
+    Session session;
+    size_t count = 0;
+    bool pressed = false;
+
+    for (auto _ : state) {
+        pressed = !pressed;
+        size_t before = allocations;
+        session.protocol.setFunction(12, pressed);
+        count += allocations - before;
+    }
+
+    reportAllocations(state, count);
+}
+BENCHMARK(outbound_setFunction);
+
+
+BENCHMARK_MAIN();
@@ -59,7 +59,8 @@ const int port = 12090;
 static volatile bool wifi_connected = false;
 
 WiFiClient client;
-WiThrottleProtocol wiThrottleConnection;
+// only the fast clock, which keeps the connection small
+BasicWiThrottleProtocol<WiThrottleFastClockFeatures> wiThrottleConnection;
 
 Adafruit_7segment clockDisplay = Adafruit_7segment();
 
@@ -77,8 +78,9 @@ void wifiOnConnect() {
   }
   else {
     Serial.println("connected succeeded");
-    wiThrottleConnection.connect(&client);
-    wiThrottleConnection.setDeviceName("mylittlethrottle");
+    WiThrottleConnectOptions options;
+    options.deviceName = "mylittlethrottle";
+    wiThrottleConnection.connect(&client, options);
   }
 }
 
@@ -0,0 +1,252 @@
+/* -*- c++ -*-
+ *
+ * FakeServer
+ *
+ * A fake WiThrottle server for measuring the library, shared by the
+ * LoadGenerator sketch and the host load generator (host/loadgen.cpp).
+ * It writes the messages the library parses into an in-memory pipe at a
+ * chosen rate, optionally split across several writes, ended with
+ * \r\n\r\n the way JMRI does, and with the AT+CIPSENDBUF= noise that a
+ * Digitrax LnWi sends, and it works out how long each line took to be
+ * read by the client.
+ *
+ * Copyright 2018, 2021 by david d zuhn <zoo@blueknobby.com>
+ *
+ * This work is licensed under the Creative Commons Attribution-ShareAlike
+ * 4.0 International License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-sa/4.0/deed.en_US.
+ *
+ * You may use this work for any purposes, provided that you make your
+ * version available to anyone else.
+ */
+
+#ifndef FAKE_SERVER_H
+#define FAKE_SERVER_H
+
+#include <WiThrottleProtocol.h>
+
+
+struct LoadOptions
+{
+    LoadOptions():
+        messagesPerSecond(500),
+        maxFragment(16),
+        doubleTerminators(true),
+        lnwiNoisePercent(10)
+    { }
+
+    unsigned long messagesPerSecond;  // 0 to send as fast as possible
+    size_t maxFragment;               // largest single write, in bytes (1 splits every byte)
+    bool doubleTerminators;           // end lines with \r\n\r\n rather than \n
+    int lnwiNoisePercent;             // share of lines prefixed with AT+CIPSENDBUF=
+};
+
+
+// A one way, fixed size, in-memory byte pipe.  Two of these make a
+// connection between the fake server and the client.
+class MemoryPipe : public Stream
+{
+  public:
+    static const size_t SIZE = 1024;
+
+    MemoryPipe() : head(0), tail(0), totalRead(0) { }
+
+    size_t space() { return SIZE - 1 - available(); }
+
+    // the number of bytes read from the pipe since it was created
+    unsigned long consumed() { return totalRead; }
+
+    virtual int available() { return (head + SIZE - tail) % SIZE; }
+
+    virtual int read() {
+        if (head == tail) {
+            return -1;
+        }
+        uint8_t b = buffer[tail];
+        tail = (tail + 1) % SIZE;
+        totalRead++;
+        return b;
+    }
+
+    virtual int peek() {
+        return (head == tail) ? -1 : buffer[tail];
+    }
+
+    virtual size_t write(uint8_t b) {
+        if (space() == 0) {
+            return 0;
+        }
+        buffer[head] = b;
+        head = (head + 1) % SIZE;
+        return 1;
+    }
+
+  private:
+    uint8_t buffer[SIZE];
+    size_t head;
+    size_t tail;
+    unsigned long totalRead;
+};
+
+
+// One end of a connection made of two pipes: reads from one, writes to
+// the other.
+class PipeConnection : public Stream
+{
+  public:
+    PipeConnection(MemoryPipe *in, MemoryPipe *out) : in(in), out(out) { }
+
+    virtual int available() { return in->available(); }
+    virtual int read() { return in->read(); }
+    virtual int peek() { return in->peek(); }
+    virtual size_t write(uint8_t b) { return out->write(b); }
+
+  private:
+    MemoryPipe *in;
+    MemoryPipe *out;
+};
+
+
+// The locomotive the messages are about.  The server releases it once
+// a cycle (MT-), so the client has to add it again (see reselect()).
+#define FAKE_SERVER_LOCOMOTIVE "L4014"
+
+// The subset of the protocol that the library parses.
+static const char *fakeServerMessages[] = {
+    "VN2.0",
+    "RL2]\\[Big Boy}|{4014}|{L]\\[Shay}|{5}|{S",
+    "PPA1",
+    "PW12080",
+    "PFT1617000000<;>4.0",
+    "*10",
+    "MT+L4014<;>Big Boy",
+    "MTAL4014<;>V42",
+    "MTAL4014<;>R1",
+    "MTAL4014<;>F112",
+    "MTAL4014<;>s2",
+    "MTA*<;>V0",
+    "MTSL4014<;>L4014",
+    "MT-L4014<;>r",
+    "PTA4LT12",
+    "PRA2IR1",
+};
+
+
+class FakeServer
+{
+  public:
+    FakeServer(MemoryPipe *toClient, MemoryPipe *fromClient, const LoadOptions& options)
+        : linesSent(0), bytesSent(0), bytesReceived(0),
+          toClient(toClient), fromClient(fromClient), options(options),
+          lineLength(0), linePosition(0), nextMessage(0),
+          lastSendTime(0), pendingHead(0), pendingTail(0) { }
+
+    // Writes a little more of the current line (or starts a new one),
+    // and reads whatever the client has sent.
+    void run() {
+        while (fromClient->read() >= 0) {
+            bytesReceived++;
+        }
+
+        if (linePosition == lineLength) {
+            if (!timeForNextLine()) {
+                return;
+            }
+            buildLine();
+        }
+
+        size_t fragment = random(1, options.maxFragment + 1);
+        while (fragment > 0 && linePosition < lineLength && toClient->space() > 0) {
+            toClient->write((uint8_t) line[linePosition++]);
+            fragment--;
+            bytesSent++;
+        }
+
+        if (linePosition == lineLength) {
+            // remember where this line ends in the byte stream, and when
+            // it was finished, so that the latency can be worked out
+            // once the client has read that far
+            size_t next = (pendingHead + 1) % MAX_PENDING;
+            if (next != pendingTail) {
+                pendingEnd[pendingHead] = bytesSent;
+                pendingTime[pendingHead] = micros();
+                pendingHead = next;
+            }
+            linesSent++;
+        }
+    }
+
+    // Called after check(), to see which lines the client has now read.
+    void measure(unsigned long now, unsigned long *latencyTotal,
+                 unsigned long *latencyMax, unsigned long *latencyCount) {
+        unsigned long consumed = toClient->consumed();
+        while (pendingTail != pendingHead && pendingEnd[pendingTail] <= consumed) {
+            unsigned long latency = now - pendingTime[pendingTail];
+            *latencyTotal += latency;
+            if (latency > *latencyMax) {
+                *latencyMax = latency;
+            }
+            (*latencyCount)++;
+            pendingTail = (pendingTail + 1) % MAX_PENDING;
+        }
+    }
+
+    // Adds the locomotive back after the server has released it, so that
+    // the MTA lines that follow are acted on rather than ignored.  Called
+    // after check().
+    template<class Protocol>
+    static void reselect(Protocol& protocol) {
+        if (protocol.consistSize() == 0) {
+            protocol.addLocomotive(FAKE_SERVER_LOCOMOTIVE);
+        }
+    }
+
+    unsigned long linesSent;
+    unsigned long bytesSent;
+    unsigned long bytesReceived;
+
+  private:
+    static const size_t MAX_PENDING = 64;
+    static const int MESSAGE_COUNT = sizeof(fakeServerMessages) / sizeof(fakeServerMessages[0]);
+
+    bool timeForNextLine() {
+        if (options.messagesPerSecond == 0) {
+            return true;
+        }
+        unsigned long now = micros();
+        if (now - lastSendTime < 1000000UL / options.messagesPerSecond) {
+            return false;
+        }
+        lastSendTime = now;
+        return true;
+    }
+
+    void buildLine() {
+        lineLength = 0;
+        if (random(100) < options.lnwiNoisePercent) {
+            lineLength += snprintf(line, sizeof(line), "AT+CIPSENDBUF=");
+        }
+        lineLength += snprintf(line + lineLength, sizeof(line) - lineLength, "%s%s",
+                               fakeServerMessages[nextMessage],
+                               options.doubleTerminators ? "\r\n\r\n" : "\n");
+        linePosition = 0;
+        nextMessage = (nextMessage + 1) % MESSAGE_COUNT;
+    }
+
+    MemoryPipe *toClient;
+    MemoryPipe *fromClient;
+    LoadOptions options;
+
+    char line[128];
+    size_t lineLength;
+    size_t linePosition;
+    int nextMessage;
+    unsigned long lastSendTime;
+
+    unsigned long pendingEnd[MAX_PENDING];
+    unsigned long pendingTime[MAX_PENDING];
+    size_t pendingHead;
+    size_t pendingTail;
+};
+
+#endif // FAKE_SERVER_H
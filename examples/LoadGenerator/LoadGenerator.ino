@@ -0,0 +1,117 @@
+/*
+ * Load Generator
+ *
+ * This sketch measures how quickly the WiThrottleProtocol library can
+ * take in server traffic, without needing a JMRI server or a network.
+ *
+ * A fake server, running in the same sketch, writes WiThrottle messages
+ * into an in-memory stream at a chosen rate.  It can split lines across
+ * several writes, end lines with \r\n\r\n the way JMRI does, and mix in
+ * the AT+CIPSENDBUF= noise that a Digitrax LnWi sends.  The client side
+ * is an ordinary WiThrottleProtocol object, and every few seconds the
+ * sketch prints the throughput and the latency from a line being
+ * written by the server to check() consuming it.
+ *
+ * The fake server is in FakeServer.h, which host/loadgen.cpp also uses
+ * to run the same load on a desktop machine.
+ *
+ * Copyright 2018, 2021 by david d zuhn <zoo@blueknobby.com>
+ *
+ * This work is licensed under the Creative Commons Attribution-ShareAlike
+ * 4.0 International License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-sa/4.0/deed.en_US.
+ *
+ * You may use this work for any purposes, provided that you make your
+ * version available to anyone else.
+ */
+
+// Change these values to suit the test you want to run...
+
+#define MESSAGES_PER_SECOND  500    // 0 to send as fast as possible
+#define MAX_FRAGMENT         16     // largest single write, in bytes (1 splits every byte)
+#define DOUBLE_TERMINATORS   true   // end lines with \r\n\r\n rather than \n
+#define LNWI_NOISE_PERCENT   10     // share of lines prefixed with AT+CIPSENDBUF=
+#define REPORT_INTERVAL      5000   // milliseconds between reports
+
+
+
+#include <WiThrottleProtocol.h>
+
+#include "FakeServer.h"
+
+
+LoadOptions loadOptions()
+{
+    LoadOptions options;
+    options.messagesPerSecond = MESSAGES_PER_SECOND;
+    options.maxFragment = MAX_FRAGMENT;
+    options.doubleTerminators = DOUBLE_TERMINATORS;
+    options.lnwiNoisePercent = LNWI_NOISE_PERCENT;
+    return options;
+}
+
+MemoryPipe serverToClient;
+MemoryPipe clientToServer;
+
+// The client reads from one pipe and writes to the other.
+PipeConnection client(&serverToClient, &clientToServer);
+FakeServer server(&serverToClient, &clientToServer, loadOptions());
+
+WiThrottleProtocol wiThrottleConnection;
+LnWiInputFilter lnwiFilter;
+
+unsigned long lastReport = 0;
+unsigned long lastLines = 0;
+unsigned long lastBytes = 0;
+unsigned long latencyTotal = 0;
+unsigned long latencyMax = 0;
+unsigned long latencyCount = 0;
+
+
+void setup()
+{
+    Serial.begin(115200);
+
+    // no console, so that logging doesn't swamp the measurement
+    wiThrottleConnection.begin(NULL);
+    if (LNWI_NOISE_PERCENT > 0) {
+        wiThrottleConnection.setInputFilter(&lnwiFilter);
+    }
+
+    WiThrottleConnectOptions options;
+    options.deviceName = "loadgenerator";
+    options.locomotive = FAKE_SERVER_LOCOMOTIVE;
+    wiThrottleConnection.connect(&client, options);
+
+    lastReport = millis();
+}
+
+
+void loop()
+{
+    server.run();
+
+    wiThrottleConnection.check();
+    FakeServer::reselect(wiThrottleConnection);
+    server.measure(micros(), &latencyTotal, &latencyMax, &latencyCount);
+
+    unsigned long now = millis();
+    if (now - lastReport >= REPORT_INTERVAL) {
+        float seconds = (now - lastReport) / 1000.0;
+
+        Serial.print("lines/s "); Serial.print((server.linesSent - lastLines) / seconds);
+        Serial.print("  bytes/s "); Serial.print((server.bytesSent - lastBytes) / seconds);
+        if (latencyCount > 0) {
+            Serial.print("  latency avg "); Serial.print(latencyTotal / latencyCount);
+            Serial.print("us max "); Serial.print(latencyMax); Serial.print("us");
+        }
+        Serial.print("  ready "); Serial.println(wiThrottleConnection.isSessionReady() ? "yes" : "no");
+
+        lastReport = now;
+        lastLines = server.linesSent;
+        lastBytes = server.bytesSent;
+        latencyTotal = 0;
+        latencyMax = 0;
+        latencyCount = 0;
+    }
+}
@@ -0,0 +1,128 @@
+/*
+ * libFuzzer target for WiThrottleProtocol::check()
+ *
+ * The first byte of each input picks how the protocol object is set up,
+ * and the rest is what the server sends, handed over a few bytes at a
+ * time with the clock moving on between pieces so that the heartbeat,
+ * fast clock, momentum and layout command timeouts all get to run.
+ *
+ *   bit 0      act as the server end (WiThrottleProtocol(true))
+ *   bit 1      use the LnWi input filter
+ *   bit 2      connect with locomotive L3 selected
+ *   bit 3      start a momentum ramp, and send a turnout and a route
+ *              command that wait for confirmation
+ *   bits 4-7   piece size: 4 * n + 1 bytes
+ *
+ * Copyright © 2018-2019, 2021 Blue Knobby Systems Inc.
+ *
+ * This work is licensed under the Creative Commons Attribution-ShareAlike
+ * 4.0 International License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-sa/4.0/ or send a letter to
+ * Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+ *
+ * All other rights reserved.
+ *
+ */
+
+#include "WiThrottleProtocol.h"
+
+#include "HostStreams.h"
+
+
+// Every argument the library passes out is read in full, so that
+// AddressSanitizer sees any that point somewhere they shouldn't.
+static volatile size_t sink;
+
+static void touch(const char *text) { sink += strlen(text); }
+static void touch(const String& s) { touch(s.c_str()); }
+
+
+class FuzzDelegate : public WiThrottleProtocolDelegate
+{
+  public:
+    void receivedVersion(String version) { touch(version); }
+    void heartbeatConfig(int seconds) { sink += seconds; }
+    void receivedFunctionState(uint8_t func, bool state) { sink += func + state; }
+    void receivedSpeed(int speed) { sink += speed; }
+    void receivedDirection(Direction dir) { sink += dir; }
+    void receivedSpeedSteps(int steps) { sink += steps; }
+    void receivedWebPort(int port) { sink += port; }
+    void receivedTrackPower(TrackPower state) { sink += state; }
+    // some are taken here and some left for nextServerMessage()
+    bool receivedServerMessage(ServerMessageType type, const char *text) { touch(text); return sink & 1; }
+    void addressAdded(String address, String entry) { touch(address); touch(entry); }
+    void addressRemoved(String address, String command) { touch(address); touch(command); }
+    void addressStealNeeded(String address, String entry) { touch(address); touch(entry); }
+    void receivedConsistState(int speed, Direction direction, bool inStep) { sink += speed + direction + inStep; }
+    void receivedTurnoutState(String systemName, TurnoutState state) { touch(systemName); }
+    void receivedRouteState(String systemName, RouteState state) { touch(systemName); }
+    void turnoutCommandFinished(String systemName, bool confirmed, unsigned long latency) { touch(systemName); }
+    void routeCommandFinished(String systemName, bool confirmed, unsigned long latency) { touch(systemName); }
+};
+
+
+class FuzzClock : public WiThrottleClock
+{
+  public:
+    FuzzClock() : time(0) { }
+    virtual unsigned long now() { return time; }
+    unsigned long time;
+};
+
+
+extern "C" int
+LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    if (size < 1) {
+        return 0;
+    }
+    uint8_t setup = data[0];
+    data++;
+    size--;
+
+    FuzzClock clock;
+    MemoryStream network;
+    FuzzDelegate delegate;
+    LnWiInputFilter lnwiFilter;
+
+    WiThrottleProtocol protocol(setup & 0x01);
+    protocol.delegate = &delegate;
+    protocol.setClock(&clock);
+    if (setup & 0x02) {
+        protocol.setInputFilter(&lnwiFilter);
+    }
+
+    WiThrottleConnectOptions options;
+    if (setup & 0x04) {
+        options.locomotive = "L3";
+    }
+    protocol.connect(&network, options);
+
+    if (setup & 0x08) {
+        protocol.setMomentum(50, 50);
+        protocol.setTargetSpeed(126);
+        protocol.setTurnout("LT1", TurnoutThrow);
+        protocol.setRoute("IR1");
+    }
+
+    size_t piece = 4 * (setup >> 4) + 1;
+    for (size_t offset = 0; offset < size; offset += piece) {
+        network.load(data + offset, min(piece, size - offset));
+        protocol.check();
+        clock.time += 700;
+    }
+
+    // long enough for every ramp and timeout to run out
+    for (int i = 0; i < 8; i++) {
+        clock.time += 1000;
+        protocol.check();
+    }
+
+    ServerMessageType type;
+    const char *text;
+    while (protocol.nextServerMessage(&type, &text)) {
+        touch(text);
+    }
+
+    return 0;
+}
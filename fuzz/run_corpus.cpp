@@ -0,0 +1,98 @@
+/*
+ * Runs each file (or each file in each directory) named on the command
+ * line through LLVMFuzzerTestOneInput() once.  This is for toolchains
+ * without libFuzzer: built with the sanitizers, it checks the seed corpus
+ * and any crash reproducers.
+ *
+ * Copyright © 2018-2019, 2021 Blue Knobby Systems Inc.
+ *
+ * This work is licensed under the Creative Commons Attribution-ShareAlike
+ * 4.0 International License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-sa/4.0/ or send a letter to
+ * Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+ *
+ * All other rights reserved.
+ *
+ */
+
+#include <dirent.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+
+static int
+runFile(const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        perror(path);
+        return 1;
+    }
+
+    size_t size = 0;
+    size_t capacity = 4096;
+    uint8_t *data = (uint8_t *) malloc(capacity);
+    size_t n;
+    while ((n = fread(data + size, 1, capacity - size, file)) > 0) {
+        size += n;
+        if (size == capacity) {
+            capacity *= 2;
+            data = (uint8_t *) realloc(data, capacity);
+        }
+    }
+    fclose(file);
+
+    LLVMFuzzerTestOneInput(data, size);
+    free(data);
+    printf("%s ok\n", path);
+    return 0;
+}
+
+
+static int
+runPath(const char *path)
+{
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        perror(path);
+        return 1;
+    }
+    if (!S_ISDIR(st.st_mode)) {
+        return runFile(path);
+    }
+
+    struct dirent **entries;
+    int count = scandir(path, &entries, NULL, alphasort);
+    if (count < 0) {
+        perror(path);
+        return 1;
+    }
+
+    int failures = 0;
+    for (int i = 0; i < count; i++) {
+        if (entries[i]->d_name[0] != '.') {
+            char child[4096];
+            snprintf(child, sizeof(child), "%s/%s", path, entries[i]->d_name);
+            failures += runPath(child);
+        }
+        free(entries[i]);
+    }
+    free(entries);
+    return failures;
+}
+
+
+int
+main(int argc, char **argv)
+{
+    int failures = 0;
+    for (int i = 1; i < argc; i++) {
+        failures += runPath(argv[i]);
+    }
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,149 @@
+/*
+ * Arduino core functions for host builds
+ *
+ * Copyright © 2018-2019, 2021 Blue Knobby Systems Inc.
+ *
+ * This work is licensed under the Creative Commons Attribution-ShareAlike
+ * 4.0 International License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-sa/4.0/ or send a letter to
+ * Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+ *
+ * All other rights reserved.
+ *
+ */
+
+#include "Arduino.h"
+
+#include <ctype.h>
+#include <stdarg.h>
+#include <time.h>
+
+
+static unsigned long long
+monotonicMicros()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long) ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static const unsigned long long startMicros = monotonicMicros();
+
+unsigned long millis() { return (monotonicMicros() - startMicros) / 1000; }
+unsigned long micros() { return monotonicMicros() - startMicros; }
+
+long random(long howbig) { return howbig > 0 ? rand() % howbig : 0; }
+long random(long howsmall, long howbig) { return howsmall < howbig ? howsmall + random(howbig - howsmall) : howsmall; }
+
+
+String::String(const char *cstr) : buffer(NULL), len(0)
+{
+    concat(cstr ? cstr : "", cstr ? strlen(cstr) : 0);
+}
+
+String::String(const String& other) : buffer(NULL), len(0)
+{
+    concat(other.buffer, other.len);
+}
+
+String::String(long value) : buffer(NULL), len(0)
+{
+    char text[24];
+    concat(text, snprintf(text, sizeof(text), "%ld", value));
+}
+
+String::~String()
+{
+    delete[] buffer;
+}
+
+String&
+String::operator=(const String& other)
+{
+    if (this != &other) {
+        len = 0;
+        concat(other.buffer, other.len);
+    }
+    return *this;
+}
+
+// every change of length makes a new buffer, as realloc() does on the
+// small heaps the library normally runs on
+void
+String::concat(const char *text, size_t n)
+{
+    char *grown = new char[len + n + 1];
+    if (buffer) {
+        memcpy(grown, buffer, len);
+    }
+    memcpy(grown + len, text, n);
+    grown[len + n] = 0;
+    delete[] buffer;
+    buffer = grown;
+    len += n;
+}
+
+int
+String::indexOf(const char *cstr) const
+{
+    const char *found = strstr(buffer, cstr);
+    return found ? found - buffer : -1;
+}
+
+String
+String::substring(unsigned int from, unsigned int to) const
+{
+    String result;
+    if (to > len) {
+        to = len;
+    }
+    if (from < to) {
+        result.concat(buffer + from, to - from);
+    }
+    return result;
+}
+
+void
+String::trim()
+{
+    unsigned int start = 0;
+    while (start < len && isspace((unsigned char) buffer[start])) {
+        start++;
+    }
+    unsigned int end = len;
+    while (end > start && isspace((unsigned char) buffer[end - 1])) {
+        end--;
+    }
+    memmove(buffer, buffer + start, end - start);
+    len = end - start;
+    buffer[len] = 0;
+}
+
+String operator+(const String& a, const String& b) { String s(a); s += b; return s; }
+String operator+(const String& a, const char *b) { String s(a); s += b; return s; }
+String operator+(const char *a, const String& b) { String s(a); s += b; return s; }
+
+
+size_t
+Print::write(const uint8_t *buffer, size_t size)
+{
+    size_t n = 0;
+    while (n < size && write(buffer[n])) {
+        n++;
+    }
+    return n;
+}
+
+size_t
+Print::printf(const char *format, ...)
+{
+    char text[256];
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+    if (n < 0) {
+        return 0;
+    }
+    return write((const uint8_t *) text, min((size_t) n, sizeof(text) - 1));
+}
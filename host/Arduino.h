@@ -0,0 +1,114 @@
+/* -*- c++ -*-
+ *
+ * Arduino.h for host builds
+ *
+ * Just enough of the Arduino core to compile the WiThrottleProtocol
+ * library on a desktop machine, for the replay driver, the fuzz target
+ * and the benchmarks.  String keeps its text on the heap the way the
+ * Arduino one does, so allocation counts mean the same thing here.
+ *
+ * Copyright © 2018-2019, 2021 Blue Knobby Systems Inc.
+ *
+ * This work is licensed under the Creative Commons Attribution-ShareAlike
+ * 4.0 International License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-sa/4.0/ or send a letter to
+ * Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+ *
+ * All other rights reserved.
+ *
+ */
+
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include <type_traits>
+
+unsigned long millis();
+unsigned long micros();
+long random(long howbig);
+long random(long howsmall, long howbig);
+
+template<typename A, typename B> inline typename std::common_type<A, B>::type min(A a, B b) { return a < b ? a : b; }
+template<typename A, typename B> inline typename std::common_type<A, B>::type max(A a, B b) { return a > b ? a : b; }
+#define constrain(x, low, high) ((x) < (low) ? (low) : ((x) > (high) ? (high) : (x)))
+
+
+class String
+{
+  public:
+    String(const char *cstr = "");
+    String(const String& other);
+    explicit String(long value);
+    ~String();
+
+    String& operator=(const String& other);
+    String& operator+=(const String& other) { concat(other.buffer, other.len); return *this; }
+    String& operator+=(const char *cstr) { concat(cstr, strlen(cstr)); return *this; }
+    String& operator+=(char c) { concat(&c, 1); return *this; }
+    void concat(const String& other) { concat(other.buffer, other.len); }
+    void concat(const char *cstr) { concat(cstr, strlen(cstr)); }
+
+    unsigned int length() const { return len; }
+    const char *c_str() const { return buffer; }
+    char operator[](unsigned int index) const { return index < len ? buffer[index] : 0; }
+
+    bool equals(const String& other) const { return len == other.len && memcmp(buffer, other.buffer, len) == 0; }
+    bool equals(const char *cstr) const { return strcmp(buffer, cstr) == 0; }
+    bool operator==(const String& other) const { return equals(other); }
+    bool operator==(const char *cstr) const { return equals(cstr); }
+
+    int indexOf(const char *cstr) const;
+    String substring(unsigned int from, unsigned int to = (unsigned int) -1) const;
+    void trim();
+
+  private:
+    void concat(const char *text, size_t n);
+
+    char *buffer;
+    unsigned int len;
+};
+
+String operator+(const String& a, const String& b);
+String operator+(const String& a, const char *b);
+String operator+(const char *a, const String& b);
+
+
+class Print
+{
+  public:
+    virtual ~Print() { }
+    virtual size_t write(uint8_t b) = 0;
+    virtual size_t write(const uint8_t *buffer, size_t size);
+    size_t write(const char *cstr) { return write((const uint8_t *) cstr, strlen(cstr)); }
+
+    size_t print(const char *cstr) { return write(cstr); }
+    size_t print(const String& s) { return write(s.c_str()); }
+    size_t print(char c) { return write((uint8_t) c); }
+    size_t print(long value) { return printf("%ld", value); }
+    size_t print(int value) { return print((long) value); }
+    size_t print(unsigned long value) { return printf("%lu", value); }
+    size_t print(double value) { return printf("%.2f", value); }
+    size_t println() { return write("\r\n"); }
+    template<typename T> size_t println(T value) { size_t n = print(value); return n + println(); }
+
+    size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+};
+
+
+class Stream : public Print
+{
+  public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+    virtual void flush() { }
+};
+
+#endif // HOST_ARDUINO_H
@@ -0,0 +1,13 @@
+/* -*- c++ -*-
+ *
+ * ArduinoTime.h for host builds.  Everything the library needs comes
+ * from TimeLib.h.
+ *
+ */
+
+#ifndef HOST_ARDUINOTIME_H
+#define HOST_ARDUINOTIME_H
+
+#include "TimeLib.h"
+
+#endif // HOST_ARDUINOTIME_H
@@ -0,0 +1,89 @@
+/* -*- c++ -*-
+ *
+ * Streams for host builds
+ *
+ * Copyright © 2018-2019, 2021 Blue Knobby Systems Inc.
+ *
+ * This work is licensed under the Creative Commons Attribution-ShareAlike
+ * 4.0 International License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-sa/4.0/ or send a letter to
+ * Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+ *
+ * All other rights reserved.
+ *
+ */
+
+#ifndef HOST_STREAMS_H
+#define HOST_STREAMS_H
+
+#include "Arduino.h"
+
+
+// Reads from a block of memory, and counts (then forgets) what is written.
+class MemoryStream : public Stream
+{
+  public:
+    MemoryStream() : data(NULL), size(0), position(0), written(0) { }
+
+    // the bytes are not copied, and must stay put while they are read
+    void load(const uint8_t *data, size_t size) {
+        this->data = data;
+        this->size = size;
+        position = 0;
+    }
+
+    size_t bytesWritten() { return written; }
+
+    virtual int available() { return size - position; }
+    virtual int read() { return position < size ? data[position++] : -1; }
+    virtual int peek() { return position < size ? data[position] : -1; }
+    virtual size_t write(uint8_t b) { written++; return 1; }
+    virtual size_t write(const uint8_t *buffer, size_t size) { written += size; return size; }
+
+  private:
+    const uint8_t *data;
+    size_t size;
+    size_t position;
+    size_t written;
+};
+
+
+// Reads from a file.  Anything written is thrown away.
+class FileStream : public Stream
+{
+  public:
+    FileStream(FILE *file) : file(file) { }
+
+    virtual int available() {
+        int b = peek();
+        return b < 0 ? 0 : 1;
+    }
+    virtual int read() {
+        int b = fgetc(file);
+        return b == EOF ? -1 : b;
+    }
+    virtual int peek() {
+        int b = fgetc(file);
+        if (b != EOF) {
+            ungetc(b, file);
+        }
+        return b == EOF ? -1 : b;
+    }
+    virtual size_t write(uint8_t b) { return 1; }
+
+  private:
+    FILE *file;
+};
+
+
+// Writes to standard output, for the console given to begin().
+class StdoutStream : public Stream
+{
+  public:
+    virtual int available() { return 0; }
+    virtual int read() { return -1; }
+    virtual int peek() { return -1; }
+    virtual size_t write(uint8_t b) { return fputc(b, stdout) == EOF ? 0 : 1; }
+};
+
+#endif // HOST_STREAMS_H
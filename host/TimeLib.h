@@ -0,0 +1,16 @@
+/* -*- c++ -*-
+ *
+ * TimeLib.h for host builds: the parts of the Time library that the
+ * fast clock uses.
+ *
+ */
+
+#ifndef HOST_TIMELIB_H
+#define HOST_TIMELIB_H
+
+#include <time.h>
+
+inline int hour(time_t t) { return (int) ((t / 3600) % 24); }
+inline int minute(time_t t) { return (int) ((t / 60) % 60); }
+
+#endif // HOST_TIMELIB_H
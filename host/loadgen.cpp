@@ -0,0 +1,134 @@
+/*
+ * Load generator
+ *
+ * Runs the LoadGenerator example's fake server (examples/LoadGenerator/
+ * FakeServer.h) against a WiThrottleProtocol object on a desktop machine,
+ * joined by an in-memory pipe pair, and prints the throughput and the
+ * latency from the server finishing a line to check() consuming it.
+ *
+ *     loadgen [-s] [-f bytes] [-l percent] [-n lines] [-t seconds]
+ *
+ *     -f   largest single write by the server, in bytes (default 16; 1
+ *          splits every byte)
+ *     -l   share of lines prefixed with the LnWi's AT+CIPSENDBUF= noise,
+ *          in percent (default 10); the LnWi input filter is used when
+ *          this isn't 0
+ *     -n   lines per second to send (default 500; 0 for as fast as
+ *          possible)
+ *     -s   end lines with a single \n, rather than \r\n\r\n as JMRI does
+ *     -t   how long to run, in seconds (default 5)
+ *
+ * The exit status is 1 if the session never became ready or no line was
+ * consumed.
+ *
+ * Copyright © 2018-2019, 2021 Blue Knobby Systems Inc.
+ *
+ * This work is licensed under the Creative Commons Attribution-ShareAlike
+ * 4.0 International License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-sa/4.0/ or send a letter to
+ * Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+ *
+ * All other rights reserved.
+ *
+ */
+
+#include <unistd.h>
+
+#include "WiThrottleProtocol.h"
+#include "FakeServer.h"
+
+
+static const unsigned long REPORT_INTERVAL = 1000;  // milliseconds
+
+
+int
+main(int argc, char **argv)
+{
+    const char *usage = "usage: %s [-s] [-f bytes] [-l percent] [-n lines] [-t seconds]\n";
+    LoadOptions options;
+    unsigned long seconds = 5;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "f:l:n:st:")) != -1) {
+        switch (opt) {
+        case 'f': options.maxFragment = atoi(optarg); break;
+        case 'l': options.lnwiNoisePercent = atoi(optarg); break;
+        case 'n': options.messagesPerSecond = strtoul(optarg, NULL, 10); break;
+        case 's': options.doubleTerminators = false; break;
+        case 't': seconds = strtoul(optarg, NULL, 10); break;
+        default:
+            fprintf(stderr, usage, argv[0]);
+            return 2;
+        }
+    }
+    if (optind != argc || options.maxFragment < 1) {
+        fprintf(stderr, usage, argv[0]);
+        return 2;
+    }
+
+    MemoryPipe serverToClient;
+    MemoryPipe clientToServer;
+    PipeConnection client(&serverToClient, &clientToServer);
+    FakeServer server(&serverToClient, &clientToServer, options);
+
+    WiThrottleProtocol protocol;
+    LnWiInputFilter lnwiFilter;
+    if (options.lnwiNoisePercent > 0) {
+        protocol.setInputFilter(&lnwiFilter);
+    }
+
+    WiThrottleConnectOptions connectOptions;
+    connectOptions.deviceName = "loadgen";
+    connectOptions.locomotive = FAKE_SERVER_LOCOMOTIVE;
+    protocol.connect(&client, connectOptions);
+
+    unsigned long start = millis();
+    unsigned long lastReport = start;
+    unsigned long lastLines = 0;
+    unsigned long lastBytes = 0;
+    unsigned long latencyTotal = 0, latencyMax = 0, latencyCount = 0;
+    unsigned long allTotal = 0, allMax = 0, allCount = 0;
+    bool ready = false;
+
+    while (millis() - start < seconds * 1000) {
+        server.run();
+
+        protocol.check();
+        FakeServer::reselect(protocol);
+        server.measure(micros(), &latencyTotal, &latencyMax, &latencyCount);
+        ready |= protocol.isSessionReady();
+
+        unsigned long now = millis();
+        if (now - lastReport >= REPORT_INTERVAL) {
+            double elapsed = (now - lastReport) / 1000.0;
+            printf("lines/s %.0f  bytes/s %.0f", (server.linesSent - lastLines) / elapsed,
+                   (server.bytesSent - lastBytes) / elapsed);
+            if (latencyCount > 0) {
+                printf("  latency avg %luus max %luus", latencyTotal / latencyCount, latencyMax);
+            }
+            printf("\n");
+
+            allTotal += latencyTotal;
+            allMax = max(allMax, latencyMax);
+            allCount += latencyCount;
+            lastReport = now;
+            lastLines = server.linesSent;
+            lastBytes = server.bytesSent;
+            latencyTotal = latencyMax = latencyCount = 0;
+        }
+    }
+
+    allTotal += latencyTotal;
+    allMax = max(allMax, latencyMax);
+    allCount += latencyCount;
+    double elapsed = (millis() - start) / 1000.0;
+    printf("total: %lu lines, %lu bytes in %.1fs (%.0f lines/s), %lu bytes from the client",
+           server.linesSent, server.bytesSent, elapsed, server.linesSent / elapsed,
+           server.bytesReceived);
+    if (allCount > 0) {
+        printf(", latency avg %luus max %luus", allTotal / allCount, allMax);
+    }
+    printf(", session %s\n", ready ? "ready" : "never ready");
+
+    return (ready && allCount > 0) ? 0 : 1;
+}
@@ -0,0 +1,157 @@
+/*
+ * Replay driver
+ *
+ * Plays a recording made by WiThrottleRecorder through a WiThrottleProtocol
+ * object on a desktop machine, and prints every delegate call along with
+ * the time in the recording at which it was made.  The protocol runs on
+ * the replay's clock, so the output is the same on every run.
+ *
+ *     replay [-l] [-r] [-v] [-a address] recording
+ *
+ *     -a   connect with this locomotive selected, as the recorded
+ *          client did ([S|L]nnnn)
+ *     -l   use the LnWi input filter
+ *     -r   play the recording in real time, each record held back until
+ *          as long has passed as in the original session (the times
+ *          printed are then real ones, and vary from run to run)
+ *     -v   also print the library's own log
+ *
+ * Copyright © 2018-2019, 2021 Blue Knobby Systems Inc.
+ *
+ * This work is licensed under the Creative Commons Attribution-ShareAlike
+ * 4.0 International License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-sa/4.0/ or send a letter to
+ * Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+ *
+ * All other rights reserved.
+ *
+ */
+
+#include <stdarg.h>
+#include <unistd.h>
+
+#include "WiThrottleProtocol.h"
+#include "WiThrottleRecorder.h"
+
+#include "HostStreams.h"
+
+
+// the replay's clock as each check() started, which is the time that
+// the protocol's timers and the record it reads both belong to
+static unsigned long checkTime;
+
+static void
+event(const char *format, ...) __attribute__((format(printf, 1, 2)));
+
+static void
+event(const char *format, ...)
+{
+    printf("%8lu ", checkTime);
+    va_list args;
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+    printf("\n");
+}
+
+
+class PrintingDelegate : public WiThrottleProtocolDelegate
+{
+  public:
+    void receivedVersion(String version) { event("version %s", version.c_str()); }
+    void sessionReady() { event("session ready"); }
+    void fastTimeChanged(uint32_t time) { event("fast time %u", time); }
+    void fastTimeRateChanged(double rate) { event("fast time rate %.2f", rate); }
+    void heartbeatConfig(int seconds) { event("heartbeat %d", seconds); }
+    void receivedFunctionState(uint8_t func, bool state) { event("function %u %s", func, state ? "on" : "off"); }
+    void receivedSpeed(int speed) { event("speed %d", speed); }
+    void receivedDirection(Direction dir) { event("direction %s", dir == Forward ? "forward" : "reverse"); }
+    void receivedSpeedSteps(int steps) { event("speed steps %d", steps); }
+    void receivedWebPort(int port) { event("web port %d", port); }
+    void receivedTrackPower(TrackPower state) { event("track power %d", state); }
+    bool receivedServerMessage(ServerMessageType type, const char *text) { event("message %c %s", type, text); return true; }
+    void addressAdded(String address, String entry) { event("added %s %s", address.c_str(), entry.c_str()); }
+    void addressRemoved(String address, String command) { event("removed %s %s", address.c_str(), command.c_str()); }
+    void addressStealNeeded(String address, String entry) { event("steal needed %s %s", address.c_str(), entry.c_str()); }
+    void receivedConsistState(int speed, Direction direction, bool inStep) {
+        event("consist %d %s%s", speed, direction == Forward ? "forward" : "reverse", inStep ? "" : " (not in step)");
+    }
+    void receivedTurnoutState(String systemName, TurnoutState state) { event("turnout %s %d", systemName.c_str(), state); }
+    void receivedRouteState(String systemName, RouteState state) { event("route %s %d", systemName.c_str(), state); }
+};
+
+
+int
+main(int argc, char **argv)
+{
+    const char *usage = "usage: %s [-l] [-r] [-v] [-a address] recording\n";
+    WiThrottleConnectOptions options;
+    bool lnwi = false;
+    bool realTime = false;
+    bool verbose = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "a:lrv")) != -1) {
+        switch (opt) {
+        case 'a': options.locomotive = optarg; break;
+        case 'l': lnwi = true; break;
+        case 'r': realTime = true; break;
+        case 'v': verbose = true; break;
+        default:
+            fprintf(stderr, usage, argv[0]);
+            return 2;
+        }
+    }
+    if (optind != argc - 1) {
+        fprintf(stderr, usage, argv[0]);
+        return 2;
+    }
+
+    FILE *file = fopen(argv[optind], "rb");
+    if (file == NULL) {
+        perror(argv[optind]);
+        return 1;
+    }
+
+    FileStream recording(file);
+    WiThrottleReplay player(&recording);
+    player.setRealTime(realTime);
+
+    StdoutStream console;
+    PrintingDelegate delegate;
+    LnWiInputFilter lnwiFilter;
+
+    WiThrottleProtocol protocol;
+    protocol.begin(verbose ? &console : NULL);
+    protocol.delegate = &delegate;
+    if (lnwi) {
+        protocol.setInputFilter(&lnwiFilter);
+    }
+    protocol.setClock(&player);
+    protocol.connect(&player, options);
+
+    // the fast clock has no delegate method, so report it here whenever
+    // the minute shown would change
+    int lastMinute = -1;
+    bool more = true;
+    while (more) {
+        more = !player.finished();
+        checkTime = player.now();
+        protocol.check();
+        if (protocol.fastTimeRate() > 0.0) {
+            int minute = protocol.fastTimeHours() * 60 + protocol.fastTimeMinutes();
+            if (minute != lastMinute) {
+                event("fast clock %02d:%02d", minute / 60, minute % 60);
+                lastMinute = minute;
+            }
+        }
+        if (realTime) {
+            // waiting for the next record, no need to spin flat out
+            usleep(1000);
+        }
+    }
+
+    event("end of recording");
+    fclose(file);
+    return 0;
+}
@@ -0,0 +1,60 @@
+#!/usr/bin/env python3
+#
+# Turns a readable session transcript into a recording in the format that
+# WiThrottleRecorder writes, so that sample sessions can be kept as text.
+#
+# Each line of a transcript is
+#
+#     <milliseconds> <direction> <text>
+#
+# where the time is from the start of the session, the direction is < for
+# bytes from the server or > for bytes to the server, and the text may use
+# backslash escapes (\r, \n, \\).  A newline is added to the end of every
+# text.  Blank lines and lines starting with # are ignored.
+#
+#     transcript2rec.py session.txt session.rec
+
+import codecs
+import sys
+
+
+def varint(value):
+    out = bytearray()
+    while True:
+        group = value & 0x7f
+        value >>= 7
+        if value:
+            out.append(group | 0x80)
+        else:
+            out.append(group)
+            return out
+
+
+def convert(lines):
+    out = bytearray()
+    last = 0
+    for number, line in enumerate(lines, 1):
+        line = line.rstrip('\n')
+        if not line.strip() or line.startswith('#'):
+            continue
+        when, direction, text = line.split(' ', 2)
+        when = int(when)
+        if when < last or direction not in '<>':
+            sys.exit('line %d: bad time or direction' % number)
+        payload = codecs.decode(text, 'unicode_escape').encode('latin-1') + b'\n'
+        while payload:
+            chunk, payload = payload[:127], payload[127:]
+            out.append(len(chunk) | (0x80 if direction == '>' else 0))
+            out += varint(when - last)
+            out += chunk
+            last = when
+    return out
+
+
+if __name__ == '__main__':
+    if len(sys.argv) != 3:
+        sys.exit('usage: transcript2rec.py session.txt session.rec')
+    with open(sys.argv[1]) as f:
+        recording = convert(f)
+    with open(sys.argv[2], 'wb') as f:
+        f.write(recording)
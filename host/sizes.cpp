@@ -0,0 +1,140 @@
+/*
+ * Prints the size of a protocol object, the RAM each connection needs,
+ * for each of the feature policies.  They are all built into this one
+ * program, as a sketch with a fast clock and a panel would be.
+ *
+ * Each policy also has a small sketch, sketch<Features>(), that uses
+ * what a sketch built with it typically would, so that the library code
+ * for that policy is instantiated; sizes.py adds up the code and data
+ * that belongs to each.
+ *
+ *     sizes          print "name features bytes" for each policy
+ *
+ * Copyright © 2018-2019, 2021 Blue Knobby Systems Inc.
+ *
+ * This work is licensed under the Creative Commons Attribution-ShareAlike
+ * 4.0 International License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-sa/4.0/ or send a letter to
+ * Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+ *
+ * All other rights reserved.
+ *
+ */
+
+#include "WiThrottleProtocol.h"
+
+#include "HostStreams.h"
+
+
+struct NoLoggingFeatures : WiThrottleFeatures
+{
+    static constexpr bool logging = false;
+};
+
+
+template<class Features> void sketch(Stream *stream, Stream *console);
+
+
+// a throttle, with a consist, momentum and the odd turnout
+template<class Features>
+static void
+throttleSketch(Stream *stream, Stream *console)
+{
+    static BasicWiThrottleProtocol<Features> protocol;
+    static WiThrottleProtocolDelegate delegate;
+
+    protocol.begin(console);
+    protocol.delegate = &delegate;
+    WiThrottleConnectOptions options;
+    options.deviceName = "sizes";
+    options.locomotive = "L3";
+    protocol.connect(stream, options);
+    protocol.addLocomotive("L4");
+    protocol.setMomentum(50, 50);
+    protocol.setTargetSpeed(126);
+    protocol.setDirection(Reverse);
+    protocol.setFunction(0, true);
+    protocol.setTurnout("LT1", TurnoutThrow);
+    protocol.check();
+    ServerMessageType type;
+    const char *text;
+    while (protocol.nextServerMessage(&type, &text)) { }
+    protocol.releaseLocomotive();
+    protocol.disconnect();
+}
+
+
+template<>
+void
+sketch<WiThrottleFeatures>(Stream *stream, Stream *console)
+{
+    throttleSketch<WiThrottleFeatures>(stream, console);
+}
+
+
+template<>
+void
+sketch<NoLoggingFeatures>(Stream *stream, Stream *console)
+{
+    throttleSketch<NoLoggingFeatures>(stream, console);
+}
+
+
+// a fast clock display, like examples/DigitalFastClock
+template<>
+void
+sketch<WiThrottleFastClockFeatures>(Stream *stream, Stream *console)
+{
+    static BasicWiThrottleProtocol<WiThrottleFastClockFeatures> protocol;
+
+    protocol.connect(stream);
+    if (protocol.check() && protocol.clockChanged) {
+        console->printf("%02d:%02d\n", protocol.fastTimeHours(), protocol.fastTimeMinutes());
+    }
+    protocol.disconnect();
+}
+
+
+// a CTC panel, throwing turnouts and setting routes
+template<>
+void
+sketch<WiThrottlePanelFeatures>(Stream *stream, Stream *console)
+{
+    static BasicWiThrottleProtocol<WiThrottlePanelFeatures> protocol;
+    static WiThrottleProtocolDelegate delegate;
+
+    protocol.delegate = &delegate;
+    protocol.connect(stream);
+    protocol.beginBatch();
+    protocol.setTurnout("LT1", TurnoutThrow);
+    protocol.setRoute("IR1");
+    protocol.endBatch();
+    protocol.check();
+    ServerMessageType type;
+    const char *text;
+    while (protocol.nextServerMessage(&type, &text)) { }
+    protocol.disconnect();
+}
+
+
+template<class Features>
+static void
+report(const char *name, const char *features, Stream *stream, Stream *console)
+{
+    sketch<Features>(stream, console);
+    printf("%s %s %zu\n", name, features, sizeof(BasicWiThrottleProtocol<Features>));
+}
+
+
+int
+main(int argc, char **argv)
+{
+    MemoryStream stream;
+    MemoryStream console;
+
+    report<WiThrottleFeatures>("default", "WiThrottleFeatures", &stream, &console);
+    report<WiThrottleFastClockFeatures>("fast-clock", "WiThrottleFastClockFeatures", &stream, &console);
+    report<WiThrottlePanelFeatures>("panel", "WiThrottlePanelFeatures", &stream, &console);
+    report<NoLoggingFeatures>("no-logging", "NoLoggingFeatures", &stream, &console);
+    return 0;
+}
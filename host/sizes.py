@@ -0,0 +1,76 @@
+#!/usr/bin/env python3
+#
+# Reports, for each feature policy, the size of a protocol object and the
+# code and data that the library adds to a sketch built with it.
+#
+#     sizes.py sizes-program
+#
+# The program (sizes.cpp) prints the object sizes.  The code and data are
+# the sizes of the symbols nm finds that belong to the policy: the
+# library's templates instantiated with it, and its sketch<Features>().
+# The library code that every policy shares is reported separately.
+#
+# Copyright © 2018-2019, 2021 Blue Knobby Systems Inc.
+#
+# This work is licensed under the Creative Commons Attribution-ShareAlike
+# 4.0 International License. To view a copy of this license, visit
+# http://creativecommons.org/licenses/by-sa/4.0/ or send a letter to
+# Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+#
+# All other rights reserved.
+
+import re
+import subprocess
+import sys
+
+# what size(1) counts as text; everything else is data (or bss)
+TEXT_TYPES = 'tTwWrR'
+
+# the library's own classes that don't depend on the policy
+SHARED = re.compile(r'\b(LnWiInputFilter|WiThrottleSpeedTables|WiThrottleNullStream)\b')
+
+
+def symbols(program):
+    out = subprocess.run(['nm', '-C', '-S', '--size-sort', program],
+                         stdout=subprocess.PIPE, check=True, universal_newlines=True).stdout
+    for line in out.splitlines():
+        fields = line.split(None, 3)
+        if len(fields) == 4:
+            yield int(fields[1], 16), fields[2], fields[3]
+
+
+def add(totals, size, kind):
+    totals[0 if kind in TEXT_TYPES else 1] += size
+
+
+def main():
+    if len(sys.argv) != 2:
+        sys.exit('usage: %s sizes-program' % sys.argv[0])
+    program = sys.argv[1]
+
+    policies = []
+    out = subprocess.run([program], stdout=subprocess.PIPE, check=True,
+                         universal_newlines=True).stdout
+    for line in out.splitlines():
+        name, features, size = line.split()
+        owner = re.compile(r'<%s[,>]' % re.escape(features))
+        policies.append((name, owner, int(size), [0, 0]))
+
+    shared = [0, 0]
+    for size, kind, name in symbols(program):
+        for _, owner, _, totals in policies:
+            if owner.search(name):
+                add(totals, size, kind)
+                break
+        else:
+            if SHARED.search(name):
+                add(shared, size, kind)
+
+    print('%-12s %8s %8s %8s' % ('policy', 'object', 'text', 'data'))
+    for name, _, size, totals in policies:
+        print('%-12s %8d %8d %8d' % (name, size, totals[0], totals[1]))
+    print('%-12s %8s %8d %8d' % ('shared', '', shared[0], shared[1]))
+
+
+if __name__ == '__main__':
+    main()
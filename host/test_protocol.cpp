@@ -0,0 +1,502 @@
+/*
+ * Protocol tests
+ *
+ * Runs a protocol object on a test clock, connected to a stream that
+ * keeps each write() separately along with the time it was made, and
+ * checks exactly what is sent and when, and what the delegate is told.
+ *
+ *     test_protocol
+ *
+ * Prints each test as it passes, and stops with a non-zero exit status
+ * at the first check that fails.
+ *
+ * Copyright © 2018-2019, 2021 Blue Knobby Systems Inc.
+ *
+ * This work is licensed under the Creative Commons Attribution-ShareAlike
+ * 4.0 International License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-sa/4.0/ or send a letter to
+ * Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+ *
+ * All other rights reserved.
+ *
+ */
+
+#include <stdlib.h>
+
+#include <string>
+#include <vector>
+
+#include "WiThrottleProtocol.h"
+
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            exit(1); \
+        } \
+    } while (0)
+
+#define CHECK_EQUAL(expected, actual) \
+    do { \
+        if ((expected) != (actual)) { \
+            printf("%s:%d: expected %s to be %s, was %s\n", __FILE__, __LINE__, #actual, \
+                   describe(expected).c_str(), describe(actual).c_str()); \
+            exit(1); \
+        } \
+    } while (0)
+
+static std::string describe(const std::string& s) { return "\"" + s + "\""; }
+static std::string describe(const char *s) { return describe(std::string(s)); }
+static std::string describe(unsigned long value) { return std::to_string(value); }
+static std::string describe(int value) { return std::to_string(value); }
+static std::string describe(bool value) { return value ? "true" : "false"; }
+
+
+class TestClock : public WiThrottleClock
+{
+  public:
+    TestClock() : time(0) { }
+    virtual unsigned long now() { return time; }
+
+    unsigned long time;
+};
+
+
+// What the server sends is queued with send(); everything the protocol
+// writes is kept, one entry per write(), with the clock's time.
+class CaptureStream : public Stream
+{
+  public:
+    struct Write {
+        unsigned long time;
+        std::string data;
+    };
+
+    CaptureStream(TestClock *clock) : clock(clock), position(0) { }
+
+    void send(const char *line) { input += line; input += "\r\n"; }
+
+    virtual int available() { return input.size() - position; }
+    virtual int read() { return position < input.size() ? (uint8_t) input[position++] : -1; }
+    virtual int peek() { return position < input.size() ? (uint8_t) input[position] : -1; }
+    virtual size_t write(uint8_t b) { return write(&b, 1); }
+    virtual size_t write(const uint8_t *buffer, size_t size) {
+        Write w = { clock->now(), std::string((const char *) buffer, size) };
+        writes.push_back(w);
+        return size;
+    }
+
+    // everything written so far, and the complete lines of it (with the
+    // time of the write that finished each)
+    std::string written() {
+        std::string all;
+        for (size_t i = 0; i < writes.size(); i++) {
+            all += writes[i].data;
+        }
+        return all;
+    }
+    std::vector<Write> lines() {
+        std::vector<Write> result;
+        std::string line;
+        for (size_t i = 0; i < writes.size(); i++) {
+            for (size_t j = 0; j < writes[i].data.size(); j++) {
+                char c = writes[i].data[j];
+                if (c == '\r' || c == '\n') {
+                    if (!line.empty()) {
+                        Write w = { writes[i].time, line };
+                        result.push_back(w);
+                        line.clear();
+                    }
+                }
+                else {
+                    line += c;
+                }
+            }
+        }
+        return result;
+    }
+    void clear() { writes.clear(); }
+
+    std::vector<Write> writes;
+
+  private:
+    TestClock *clock;
+    std::string input;
+    size_t position;
+};
+
+
+class RecordingDelegate : public WiThrottleProtocolDelegate
+{
+  public:
+    struct Finished {
+        unsigned long time;
+        std::string systemName;
+        bool route;
+        bool confirmed;
+        unsigned long latency;
+    };
+    struct ConsistState {
+        unsigned long time;
+        int speed;
+        Direction direction;
+        bool inStep;
+    };
+
+    RecordingDelegate(TestClock *clock) : clock(clock) { }
+
+    void turnoutCommandFinished(String systemName, bool confirmed, unsigned long latency) {
+        Finished f = { clock->now(), systemName.c_str(), false, confirmed, latency };
+        finished.push_back(f);
+    }
+    void routeCommandFinished(String systemName, bool confirmed, unsigned long latency) {
+        Finished f = { clock->now(), systemName.c_str(), true, confirmed, latency };
+        finished.push_back(f);
+    }
+    void receivedTurnoutState(String systemName, TurnoutState state) {
+        turnoutStates++;
+    }
+    void receivedConsistState(int speed, Direction direction, bool inStep) {
+        ConsistState c = { clock->now(), speed, direction, inStep };
+        consistStates.push_back(c);
+    }
+
+    std::vector<Finished> finished;
+    int turnoutStates = 0;
+    std::vector<ConsistState> consistStates;
+
+  private:
+    TestClock *clock;
+};
+
+
+// A throttle without batching, as on a board short of RAM.
+struct NoBatchFeatures : WiThrottleFeatures
+{
+    static constexpr int batchSize = 0;
+};
+
+
+// A protocol connected to a capture stream on a test clock, starting at
+// time 0 with whatever the connection itself sent already cleared.
+template<class Features = WiThrottleFeatures>
+struct Fixture
+{
+    Fixture() : stream(&clock), delegate(&clock) {
+        protocol.setClock(&clock);
+        protocol.delegate = &delegate;
+    }
+
+    void connect(const char *locomotive = "") {
+        WiThrottleConnectOptions options;
+        options.locomotive = locomotive;
+        protocol.connect(&stream, options);
+        stream.clear();
+    }
+
+    // calls check() every step milliseconds, up to and including until
+    void run(unsigned long until, unsigned long step = 10) {
+        protocol.check();
+        while (clock.time + step <= until) {
+            clock.time += step;
+            protocol.check();
+        }
+    }
+
+    TestClock clock;
+    CaptureStream stream;
+    RecordingDelegate delegate;
+    BasicWiThrottleProtocol<Features> protocol;
+};
+
+
+static std::string
+speedCommand(int speed)
+{
+    return "MTA*<;>V" + std::to_string(speed);
+}
+
+
+// With no rate limit, a 28 step ramp sends every notch's V value, one
+// per notch delay, the first as soon as it is due.
+static void
+testRamp28()
+{
+    Fixture<> f;
+    f.connect("L3");
+    f.stream.send("MTAL3<;>s2");
+    f.protocol.check();
+    f.stream.clear();
+
+    f.protocol.setMaxSpeedRate(0);
+    f.protocol.setMomentum(50, 50);
+    f.protocol.setTargetSpeed(126);
+    f.run(2000);
+
+    std::vector<CaptureStream::Write> lines = f.stream.lines();
+    CHECK_EQUAL((size_t) 28, lines.size());
+    for (int notch = 1; notch <= 28; notch++) {
+        CHECK_EQUAL(50UL * notch, lines[notch - 1].time);
+        CHECK_EQUAL(speedCommand(WiThrottleSpeedTables::steps28[notch]), lines[notch - 1].data);
+    }
+    CHECK_EQUAL(126, f.protocol.getSpeed());
+
+    // and back down again
+    f.stream.clear();
+    unsigned long start = f.clock.time;
+    f.protocol.setTargetSpeed(0);
+    f.run(start + 2000);
+    lines = f.stream.lines();
+    CHECK_EQUAL((size_t) 28, lines.size());
+    for (int notch = 27; notch >= 0; notch--) {
+        const CaptureStream::Write& line = lines[27 - notch];
+        CHECK_EQUAL(start + 50UL * (28 - notch), line.time);
+        CHECK_EQUAL(speedCommand(WiThrottleSpeedTables::steps28[notch]), line.data);
+    }
+}
+
+
+// The rate limit holds speed commands at least speedInterval apart, and
+// the ramp makes up for it by moving more than one notch at a time, so
+// it still takes as long as the momentum says.
+static void
+testRampRateLimit()
+{
+    Fixture<> f;
+    f.connect("L3");
+    f.stream.send("MTAL3<;>s2");
+    f.protocol.check();
+    f.stream.clear();
+
+    f.protocol.setMaxSpeedRate(100);
+    f.protocol.setMomentum(50, 50);
+    f.protocol.setTargetSpeed(126);
+    f.run(2000);
+
+    // notch 1 at 50ms (nothing sent yet to hold it back), then two
+    // notches every 100ms, then the last one
+    std::vector<CaptureStream::Write> lines = f.stream.lines();
+    CHECK_EQUAL((size_t) 15, lines.size());
+    CHECK_EQUAL(50UL, lines[0].time);
+    CHECK_EQUAL(speedCommand(WiThrottleSpeedTables::steps28[1]), lines[0].data);
+    for (int i = 1; i < 14; i++) {
+        CHECK_EQUAL(50UL + 100UL * i, lines[i].time);
+        CHECK_EQUAL(speedCommand(WiThrottleSpeedTables::steps28[1 + 2 * i]), lines[i].data);
+    }
+    CHECK_EQUAL(1450UL, lines[14].time);
+    CHECK_EQUAL(speedCommand(126), lines[14].data);
+
+    for (size_t i = 1; i < lines.size(); i++) {
+        CHECK(lines[i].time - lines[i - 1].time >= 100);
+    }
+}
+
+
+// Commands between beginBatch() and endBatch() reach the stream in a
+// single write.
+static void
+testBatchIsOneWrite()
+{
+    Fixture<> f;
+    f.connect("L3");
+
+    f.protocol.beginBatch();
+    f.protocol.setTurnout("LT1", TurnoutThrow);
+    f.protocol.setTurnout("LT2", TurnoutClose);
+    f.protocol.setRoute("IR1");
+    f.protocol.setFunction(0, true);
+    CHECK_EQUAL((size_t) 0, f.stream.writes.size());
+    f.protocol.endBatch();
+
+    CHECK_EQUAL((size_t) 1, f.stream.writes.size());
+    CHECK_EQUAL("PTATLT1\r\nPTACLT2\r\nPRA2IR1\r\nMTAL3<;>F10\r\n", f.stream.writes[0].data);
+}
+
+
+// A command the server never confirms finishes unconfirmed once the
+// timeout has passed, and not before.
+static void
+testTurnoutTimeout()
+{
+    Fixture<> f;
+    f.connect();
+    f.protocol.setLayoutCommandTimeout(500);
+
+    f.clock.time = 100;
+    CHECK(f.protocol.setTurnout("LT1", TurnoutThrow));
+    CHECK_EQUAL(1, f.protocol.pendingLayoutCommands());
+
+    f.run(590);
+    CHECK_EQUAL((size_t) 0, f.delegate.finished.size());
+
+    f.run(1000);
+    CHECK_EQUAL((size_t) 1, f.delegate.finished.size());
+    const RecordingDelegate::Finished& finished = f.delegate.finished[0];
+    CHECK_EQUAL(600UL, finished.time);
+    CHECK_EQUAL("LT1", finished.systemName);
+    CHECK_EQUAL(false, finished.route);
+    CHECK_EQUAL(false, finished.confirmed);
+    CHECK_EQUAL(500UL, finished.latency);
+    CHECK_EQUAL(0, f.protocol.pendingLayoutCommands());
+}
+
+
+// A command is confirmed by a report of the state it asked for, with the
+// time since it was sent; reports of other states (or of no known state
+// at all) leave it waiting.
+static void
+testTurnoutConfirmation()
+{
+    Fixture<> f;
+    f.connect();
+
+    f.clock.time = 20;
+    f.protocol.setTurnout("LT2", TurnoutThrow);
+    f.protocol.setRoute("IR1");
+
+    f.clock.time = 100;
+    f.stream.send("PTA2LT2");   // closed, not what was asked for
+    f.stream.send("PTAXLT2");   // not a state at all
+    f.protocol.check();
+    CHECK_EQUAL((size_t) 0, f.delegate.finished.size());
+    CHECK_EQUAL(1, f.delegate.turnoutStates);
+
+    f.clock.time = 250;
+    f.stream.send("PTA4LT2");
+    f.stream.send("PRA2IR1");
+    f.protocol.check();
+    CHECK_EQUAL((size_t) 2, f.delegate.finished.size());
+    CHECK_EQUAL("LT2", f.delegate.finished[0].systemName);
+    CHECK_EQUAL(true, f.delegate.finished[0].confirmed);
+    CHECK_EQUAL(230UL, f.delegate.finished[0].latency);
+    CHECK_EQUAL("IR1", f.delegate.finished[1].systemName);
+    CHECK_EQUAL(true, f.delegate.finished[1].route);
+    CHECK_EQUAL(true, f.delegate.finished[1].confirmed);
+    CHECK_EQUAL(230UL, f.delegate.finished[1].latency);
+    CHECK_EQUAL(0, f.protocol.pendingLayoutCommands());
+
+    // nothing left to time out
+    f.run(5000);
+    CHECK_EQUAL((size_t) 2, f.delegate.finished.size());
+}
+
+
+// With an inverted member, each member is sent its own direction, in one
+// write even without batching.
+static void
+testInvertedDirection()
+{
+    Fixture<NoBatchFeatures> f;
+    f.connect("L3");
+    f.protocol.addLocomotive("L4");
+    f.protocol.addLocomotive("L5");
+    CHECK(f.protocol.setConsistMemberInverted("L4", true));
+    f.stream.clear();
+
+    CHECK(f.protocol.setDirection(Forward));
+    CHECK_EQUAL((size_t) 1, f.stream.writes.size());
+    CHECK_EQUAL("MTAL3<;>R1\r\nMTAL4<;>R0\r\nMTAL5<;>R1\r\n", f.stream.writes[0].data);
+
+    f.stream.clear();
+    CHECK(f.protocol.setDirection(Reverse));
+    CHECK_EQUAL((size_t) 1, f.stream.writes.size());
+    CHECK_EQUAL("MTAL3<;>R0\r\nMTAL4<;>R1\r\nMTAL5<;>R0\r\n", f.stream.writes[0].data);
+
+    // with none inverted, the whole consist gets the same one
+    CHECK(f.protocol.setConsistMemberInverted("L4", false));
+    f.stream.clear();
+    CHECK(f.protocol.setDirection(Forward));
+    CHECK_EQUAL("MTA*<;>R1\r\n", f.stream.written());
+}
+
+
+// The consist's state is reported once every member has echoed a
+// command to the whole consist, however many check()s that takes, or
+// once the settle timeout passes if one never does.
+static void
+testConsistSettle()
+{
+    Fixture<> f;
+    f.connect("L3");
+    f.protocol.addLocomotive("L4");
+    f.protocol.addLocomotive("L5");
+    CHECK(f.protocol.setConsistMemberInverted("L4", true));
+    f.protocol.setConsistSettleTimeout(200);
+
+    f.protocol.setSpeed(20);
+    f.clock.time = 10;
+    f.stream.send("MTAL3<;>V20");
+    f.protocol.check();
+    f.clock.time = 20;
+    f.stream.send("MTAL4<;>V20");
+    f.protocol.check();
+    CHECK_EQUAL((size_t) 0, f.delegate.consistStates.size());
+    f.clock.time = 30;
+    f.stream.send("MTAL5<;>V20");
+    f.protocol.check();
+    CHECK_EQUAL((size_t) 1, f.delegate.consistStates.size());
+    CHECK_EQUAL(30UL, f.delegate.consistStates[0].time);
+    CHECK_EQUAL(20, f.delegate.consistStates[0].speed);
+    CHECK_EQUAL(true, f.delegate.consistStates[0].inStep);
+
+    // the inverted member echoes the opposite direction
+    f.clock.time = 100;
+    f.protocol.setDirection(Reverse);
+    f.clock.time = 110;
+    f.stream.send("MTAL3<;>R0");
+    f.stream.send("MTAL4<;>R1");
+    f.protocol.check();
+    f.clock.time = 120;
+    f.stream.send("MTAL5<;>R0");
+    f.protocol.check();
+    CHECK_EQUAL((size_t) 2, f.delegate.consistStates.size());
+    CHECK_EQUAL(120UL, f.delegate.consistStates[1].time);
+    CHECK(f.delegate.consistStates[1].direction == Reverse);
+    CHECK_EQUAL(true, f.delegate.consistStates[1].inStep);
+
+    // a member that never echoes holds the report only until the timeout
+    f.clock.time = 1000;
+    f.protocol.setSpeed(40);
+    f.stream.send("MTAL3<;>V40");
+    f.stream.send("MTAL4<;>V40");
+    f.run(1190);
+    CHECK_EQUAL((size_t) 2, f.delegate.consistStates.size());
+    f.run(1300);
+    CHECK_EQUAL((size_t) 3, f.delegate.consistStates.size());
+    CHECK_EQUAL(1200UL, f.delegate.consistStates[2].time);
+    CHECK_EQUAL(40, f.delegate.consistStates[2].speed);
+    CHECK_EQUAL(false, f.delegate.consistStates[2].inStep);
+
+    // a change nobody asked for is reported straight away
+    f.stream.send("MTAL5<;>V40");
+    f.protocol.check();
+    CHECK_EQUAL((size_t) 4, f.delegate.consistStates.size());
+    CHECK_EQUAL(1300UL, f.delegate.consistStates[3].time);
+    CHECK_EQUAL(true, f.delegate.consistStates[3].inStep);
+}
+
+
+static const struct {
+    const char *name;
+    void (*run)();
+} tests[] = {
+    { "ramp28", testRamp28 },
+    { "ramp-rate-limit", testRampRateLimit },
+    { "batch-is-one-write", testBatchIsOneWrite },
+    { "turnout-timeout", testTurnoutTimeout },
+    { "turnout-confirmation", testTurnoutConfirmation },
+    { "inverted-direction", testInvertedDirection },
+    { "consist-settle", testConsistSettle },
+};
+
+
+int
+main(int argc, char **argv)
+{
+    for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        tests[i].run();
+        printf("%s ok\n", tests[i].name);
+    }
+    return 0;
+}